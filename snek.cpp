@@ -4,46 +4,272 @@
 ************************/
 #include <SDL.h>
 #include <SDL_image.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "snek_bot.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <new>
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <cmath>
 
 #define BASE_WIDTH 320.0
 #define BASE_HEIGHT 240.0
+#define BOARD_WIDTH 20
+#define BOARD_HEIGHT 15
+
+// Define SNEK_TRACE to record trace zones, otherwise they compile to nothing
+#ifdef SNEK_TRACE
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(traceZone, __LINE__)(name)
+#define TRACE_BEGIN(zone) Uint64 zone = SDL_GetPerformanceCounter()
+#define TRACE_END(zone, name) TraceRecord(name, zone, SDL_GetPerformanceCounter())
+#else
+#define TRACE_ZONE(name)
+#define TRACE_BEGIN(zone)
+#define TRACE_END(zone, name)
+#endif
+
+// Texture handle, index into gTextures
+typedef int TextureHandle;
 
 // Function definition list
 void SetResolution(int);
 bool Init();
 SDL_Texture* LoadTexture(std::string);
-bool StoreTexture(std::string);
+TextureHandle AddTexture(SDL_Texture*, SDL_Surface*, std::string, int);
+TextureHandle StoreTexture(std::string);
+TextureHandle StoreSurface(SDL_Surface*, std::string, int);
+SDL_Texture* GetTexture(TextureHandle);
+void RetainTexture(TextureHandle);
+void ReleaseTexture(TextureHandle);
+void ReleaseTextures(int);
+void EnforceTextureBudget(int);
+void PrintTextureStats();
 SDL_Surface* GenerateGrass();
+void UpdateGame(bool);
+void SaveKeyframe(int);
+void LoadKeyframe(int);
+unsigned int OldestRewindTick();
+bool SeekGame(unsigned int);
+void EncodeObservation(Uint8*);
+bool OpenEnvChannel(const char*);
+void CloseEnvChannel();
+bool WaitEnvAction(Uint32);
+void RunEnvServer();
+bool OpenShard();
+void ExportTransition(int, int, int);
+void CloseShard();
+void SeedGame(Uint64);
+void ResetGame();
+Uint32 Random(int);
+Uint32 RandomRange(int, Uint32);
+bool AppleCell(int, int);
+void PlaceApple();
+bool LoadLevel(std::string);
+int StepCell(int, int);
+Uint64 HashLevel();
+void BuildDistances();
+bool LoadDistances(Uint64);
+void SaveDistances(Uint64);
+int LevelDistance(int, int, int, int);
+bool LoadBot(const char*);
+int BotWorker(void*);
+bool BotIdle();
+int BotTurn();
+void RecordBotLatency();
+void PrintBotStats();
+void StopBot();
+bool CellFree(int);
+int FreeRoot(int);
+void FreeUnion(int, int);
+void RebuildRegions();
+void FreeCell(int, int);
+void FillCell(int, int);
+int RegionSize(int, int);
+bool RegionsConnected(int, int, int, int);
+int FloodRegionSize(int, int);
+void BenchRegions(int);
+void RenderTile(SDL_Texture*, double, double);
+bool InitAudio();
+void GenerateSound(int, double, double, double, bool);
+void PlaySound(int);
+void MixAudio(void*, Uint8*, int);
+void* TrackMalloc(size_t);
+void* TrackCalloc(size_t, size_t);
+void* TrackRealloc(void*, size_t);
+void TrackFree(void*);
+void EndAllocFrame();
+void PrintAllocStats();
+#ifdef SNEK_TRACE
+void TraceRecord(const char*, Uint64, Uint64);
+void WriteTrace();
+#endif
+void BuildSineTable();
+void UpdateAnimations();
+bool StartTelemetry();
+void BeginGameTelemetry();
+void RecordTelemetry(int);
+void EndGameTelemetry(int);
+void TruncateTelemetry(unsigned int);
+void SubmitTelemetry();
+Uint8* WriteVarint(Uint8*, Uint32);
+int TelemetryWriter(void*);
+void StopTelemetry();
+bool StartCapture();
+void CaptureFrame();
+int CaptureWriter(void*);
+void StopCapture();
 void Close();
 
 // Global variables
 
 // Time
-unsigned int lastTime = 0, currentTime, loseTime;
+unsigned int lastTime = 0, lastLogicTime = 0, currentTime, loseTime;
 Uint16 gameSpeed = 20, gameSpeedTemp = gameSpeed * 10;
 const Uint16 stepNormal = 10;
+
+// A frame is presented once more than step ms passed, so normal frames are stepNormal + 1 ms apart
+const Uint16 stepFrame = stepNormal + 1;
 Uint16 stepLogic = 2000 / gameSpeed;
 Uint16 step = stepNormal;
+const int logicCatchUp = 5;
 
 // Math
 const double CIRCLE = M_PI / 180.0;
+double SineTable[360];
 
 // Graphics
 int screenWidth;
 int screenHeight;
 SDL_Window* gWindow = NULL;
 SDL_Renderer* gRenderer = NULL;
-std::vector<SDL_Texture*> gTextures;
+
+// Audio
+const int audioFrequency = 22050;
+Uint16 audioSamples = 512;
+SDL_AudioDeviceID gAudioDevice = 0;
+
+// Allocation tracking
+
+// Size header in front of each tracked block, keeps 16 byte alignment
+const size_t allocHeader = 16;
+
+// Flag any allocation during running gameplay in debug builds
+#ifdef _DEBUG
+bool allocAssert = true;
+#else
+bool allocAssert = false;
+#endif
+
+// Set by the main thread around game ticks only, other threads never see it
+thread_local bool allocSteady = false;
+int allocPhase = 0;
+SDL_atomic_t allocCount[4], allocBytes[4], allocLive;
+int allocFrameCount[4], allocFrameBytes[4];
+Uint64 allocTotalCount, allocTotalBytes;
+
+// Tracing
+#ifdef SNEK_TRACE
+const int traceRingSize = 16384;
+const int traceThreads = 16;
+
+// Completed zone
+struct TraceEvent
+{
+	const char* name;
+	Uint64 start, end;
+};
+
+// Per-thread ring of zones, only written by its own thread
+struct TraceRing
+{
+	TraceEvent events[traceRingSize];
+	SDL_atomic_t written;
+};
+
+// Rings are preallocated, recording never allocates, not even on the audio thread
+TraceRing traceRings[traceThreads];
+SDL_atomic_t traceRingCount;
+thread_local TraceRing* traceRing = NULL;
+
+// Scoped zone, recorded when it goes out of scope
+class TraceZone
+{
+public:
+	TraceZone(const char* zoneName) : name(zoneName), start(SDL_GetPerformanceCounter()) {}
+	~TraceZone() { TraceRecord(name, start, SDL_GetPerformanceCounter()); }
+
+private:
+	const char* name;
+	Uint64 start;
+};
+#endif
+
+// Telemetry, only recorded when asked for on the command line
+bool stateTelemetry = false;
+const int telemetryEvents = 4096;
+
+// Record of one game, events stored column by column
+struct TelemetryGame
+{
+	Uint64 seed;
+	Uint32 ticks;
+	Uint16 gameSpeed, width, height;
+	Uint8 length, endCause;
+	char endX, endY;
+	int eventCount;
+	Uint8 eventType[telemetryEvents];
+	Uint32 eventTick[telemetryEvents];
+	char eventX[telemetryEvents], eventY[telemetryEvents];
+	Uint8 eventLength[telemetryEvents];
+};
+
+// Game being recorded and game handed to writer
+TelemetryGame telemetryGames[2];
+int telemetryCurrent = 0;
+unsigned int telemetryDropped = 0;
+SDL_atomic_t telemetryPending, telemetryQuit;
+SDL_sem* telemetryReady = NULL;
+SDL_Thread* telemetryThread = NULL;
+FILE* telemetryFile = NULL;
+
+// Capture
+const int captureBuffers = 8;
+Uint8* captureFrames[captureBuffers];
+Uint8* captureYUV = NULL;
+int captureWidth, captureHeight, captureWrite, captureRead;
+unsigned int captureWritten, captureDropped;
+
+// The video runs on the fixed timeline of normal frames
+// Each buffer carries its slot on the timeline, skipped slots repeat the previous frame
+const unsigned int captureInterval = stepFrame;
+unsigned int captureStart, captureSlots[captureBuffers];
+int captureLastSlot;
+SDL_atomic_t captureCount, captureQuit;
+SDL_sem* captureReady = NULL;
+SDL_Thread* captureThread = NULL;
+FILE* captureFile = NULL;
 
 // Control
-bool userKey, userLeft, userRight, userUp, userDown, userEnter, userSpace, userEsc;
+bool userKey, userLeft, userRight, userUp, userDown, userEnter, userSpace, userEsc, userBack;
 bool userPressedKey, userPressedLeft, userPressedRight, userPressedUp, userPressedDown, userPressedEnter, userPressedSpace, userPressedEsc;
 
 // Game states
+bool stateCapture = false;
+bool stateInterpolate = true;
 bool stateTitleScreen, stateMenu, stateOptions, stateResolution, stateFullScreen, stateFullScreenTemp, stateSoftFilter, stateSoftFilterTemp, stateInGame, stateGameStart, stateGameRunning, stateGameOver;
 
 // Menu and option selections
@@ -51,6 +277,160 @@ int menuSelect = 0, optionsSelect = 0, resolutionSelect = 1, resolutionSelectTem
 
 // Game Over stuff
 double positionGameOver = -32, velocityGameOver = 0;
+unsigned int lastGameOverTime;
+
+// Game logic data
+Uint8 Snake[BOARD_HEIGHT][BOARD_WIDTH][4];
+const Uint8 snakeLengthStart = 1, snakeStartPosX = 10, snakeStartPosY = 7;
+Uint8 snakeLength, snakeDirection, snakeDirectionLast;
+char snakePosX, snakePosY, applePosX, applePosY;
+bool appleEaten = false;
+
+// Level
+
+// Level tiles, portal partners and distance field between all cells
+const Uint16 unreachable = 0xFFFF;
+bool stateLevel = false;
+Uint8 Level[BOARD_HEIGHT][BOARD_WIDTH];
+short levelPortal[BOARD_HEIGHT * BOARD_WIDTH];
+std::vector<Uint16> levelDistance;
+
+// Tile step for each SnakeDirection
+const int directionX[4] = { 0, 0, -1, 1 };
+const int directionY[4] = { -1, 1, 0, 0 };
+
+// Free space connectivity
+
+// Union-find over free cells, a filled cell stays in its tree as a ghost until the next rebuild
+// Removals that may split a region mark it dirty, the next query rebuilds
+short freeParent[BOARD_HEIGHT * BOARD_WIDTH];
+short freeSize[BOARD_HEIGHT * BOARD_WIDTH];
+bool freeGhost[BOARD_HEIGHT * BOARD_WIDTH];
+bool freeDirty = true;
+unsigned int freeRebuilds = 0;
+bool stateBenchRegions = false;
+
+// Transition export
+
+// Shard file header, records of fixed size follow it
+struct ShardHeader
+{
+	char magic[4];
+	Uint32 version;
+	Uint32 headerSize;
+	Uint32 recordSize;
+	Uint32 records;
+	Uint16 width, height, planes;
+	Uint8 padding[38];
+};
+
+bool stateExport = false;
+bool exportEpisodeStart = true;
+const Uint32 shardRecords = 65536;
+ShardHeader exportHeader;
+FILE* exportFile = NULL;
+int exportShard = 0;
+unsigned int exportSession;
+
+// Bot
+
+// Plugin entry points and the worker thread calling them
+typedef int (*BotAbiFunction)(void);
+typedef int (*BotDecideFunction)(const SnekBoard*);
+void* botObject = NULL;
+BotDecideFunction botDecide = NULL;
+SDL_Thread* botThread = NULL;
+SDL_sem* botRequest = NULL;
+SDL_sem* botReply = NULL;
+SDL_atomic_t botQuit;
+
+// Board handed to the worker and its answer
+SnekBoard botBoard;
+int botResult;
+
+// Milliseconds per decision, the worker is busy until a late answer arrives
+// The bot reads game memory, so nothing changes the board while it is busy
+Uint32 botDeadline = 2;
+bool botBusy = false;
+
+// Decision latencies in microseconds, ring of the most recent ones
+// The worker stamps its answer, so late answers are measured in full when they arrive
+const int botLatencySize = 4096;
+Uint32 botLatency[botLatencySize];
+Uint64 botStart, botEnd;
+unsigned int botDecisions = 0, botTimeouts = 0, botHeld = 0;
+
+// Rewind
+
+// Full game state, saved as periodic keyframes
+struct GameState
+{
+	Uint8 snake[BOARD_HEIGHT][BOARD_WIDTH][4];
+	Uint8 length, direction, directionLast;
+	char posX, posY, appleX, appleY;
+	bool appleEaten;
+	Uint64 appleCounter;
+};
+
+// Input of one tick, enough to re-simulate it from the previous state
+struct TickDelta
+{
+	Uint8 direction;
+};
+
+// Keyframe every rewindInterval ticks, ring covers rewindInterval * rewindKeyframes ticks
+const int rewindInterval = 64;
+const int rewindKeyframes = 256;
+GameState rewindKeyframe[rewindKeyframes];
+TickDelta rewindDelta[rewindInterval * rewindKeyframes];
+unsigned int rewindTick = 0;
+
+// Highest tick recorded this game, only grows, seeking back does not free ring slots
+unsigned int rewindRecorded = 0;
+
+// Observation feature planes (body, head, direction, apple)
+const int observationPlanes = 4;
+const int observationSize = observationPlanes * BOARD_HEIGHT * BOARD_WIDTH;
+
+// Board before the current tick, exported with its outcome
+Uint8 exportObservation[observationSize];
+
+// Environment server
+
+// One step as seen by the trainer, reward and flags belong to the action that led to it
+struct EnvSlot
+{
+	Uint8 observation[observationSize];
+	Sint8 reward;
+	Uint8 flags;
+	Uint8 padding[2];
+	Uint32 step;
+};
+
+// Shared memory layout, the server publishes slots and the trainer answers with actions
+// Step n is complete once published > n, its action once actions > n, each side only writes its own counter
+const int envSlots = 64;
+
+struct EnvChannel
+{
+	char magic[4];
+	Uint32 version;
+	Uint32 slotSize;
+	Uint32 slots;
+	Uint16 width, height, planes, padding;
+	SDL_atomic_t published;
+	SDL_atomic_t actions;
+	SDL_atomic_t quit;
+	Uint8 action[envSlots];
+	EnvSlot slot[envSlots];
+};
+
+bool stateEnvServer = false;
+const char* envName = NULL;
+EnvChannel* envChannel = NULL;
+#ifdef _WIN32
+HANDLE envMapping = NULL;
+#endif
 
 // SDL_Rects
 SDL_Rect Viewport;
@@ -113,8 +493,152 @@ enum SnakeDirection
 	RIGHT
 };
 
+// Animation enum
+enum AnimationSelect
+{
+	ANIM_TITLE,
+	ANIM_MENU,
+	ANIM_ARROW,
+	ANIM_OPTIONS,
+	ANIM_HAMMER,
+	ANIM_MINIARROW,
+	ANIM_SIZE
+};
+
+// Animation data
+
+// Spin speeds in degrees per normal frame of stepFrame ms, as the per-frame counters used to advance
+const Uint16 animSpeed[ANIM_SIZE] = { 2, 3, 10, 3, 10, 20 };
+
+// Sine and cosine of each spin, evaluated once per frame
+double animSin[ANIM_SIZE], animCos[ANIM_SIZE];
+
+// Resource class enum
+enum ResourceClass
+{
+	RESOURCE_SPRITE,
+	RESOURCE_GRASS,
+	RESOURCE_CLASS_SIZE
+};
+
+// Texture data
+
+// Texture resource, rebuildable ones keep their surface so the texture can be evicted
+struct TextureResource
+{
+	SDL_Texture* texture;
+	SDL_Surface* surface;
+	std::string name;
+	int resourceClass;
+	int references;
+	int bytes;
+	Uint32 lastUsed;
+};
+
+std::vector<TextureResource> gTextures;
+
+// GPU memory budget and bytes currently resident per resource class
+int textureBudget = 64 * 1024 * 1024;
+int textureBytes[RESOURCE_CLASS_SIZE];
+
+// Level tile enum
+enum LevelTile
+{
+	TILE_EMPTY,
+	TILE_WALL,
+	TILE_PORTAL
+};
+
+// Random stream enum
+enum RandomStream
+{
+	RANDOM_GRASS,
+	RANDOM_APPLE,
+	RANDOM_SIZE
+};
+
+// Random data
+
+// Seed from command line, 0 picks a new seed each game
+Uint64 seedOption = 0;
+
+// Seed of current game and position in each stream
+Uint64 gameSeed;
+Uint64 randomCounter[RANDOM_SIZE];
+
+// Telemetry event enum
+enum TelemetryEvent
+{
+	EVENT_TURN,
+	EVENT_APPLE
+};
+
+// Game end enum
+enum GameEnd
+{
+	END_NONE,
+	END_CRASH,
+	END_ESCAPE,
+	END_QUIT
+};
+
+// Export record flag enum
+enum ExportFlag
+{
+	EXPORT_START = 1,
+	EXPORT_DONE = 2
+};
+
+// Allocation phase enum
+enum AllocPhase
+{
+	PHASE_OTHER,
+	PHASE_EVENTS,
+	PHASE_STATES,
+	PHASE_PRESENT,
+	PHASE_SIZE
+};
+
+// Sound effect enum
+enum SoundSelect
+{
+	SOUND_EAT,
+	SOUND_TURN,
+	SOUND_GAMEOVER,
+	SOUND_MENU,
+	SOUND_SIZE
+};
+
+// Audio data
+
+// Sound effects, generated into memory at load time
+std::vector<Sint16> gSounds[SOUND_SIZE];
+
+// Play commands from game logic to mixer, single producer and single consumer
+const int soundQueueSize = 32;
+Uint8 soundQueue[soundQueueSize];
+SDL_atomic_t soundQueueHead, soundQueueTail;
+
+// Mixer voices, only touched by the audio thread
+const int soundVoices = 8;
+const Sint16* voiceSound[soundVoices];
+int voiceLength[soundVoices], voicePosition[soundVoices];
+
 // Function implementations
 
+// Wrap board coordinate around an edge of SIZE tiles
+// Power-of-two sizes fold to a mask at compile time, others to a single compare
+template <int SIZE>
+inline int Wrap(int pos)
+{
+	if ((SIZE & (SIZE - 1)) == 0)
+		return pos & (SIZE - 1);
+
+	if (pos < 0) return pos + SIZE;
+	if (pos >= SIZE) return pos - SIZE;
+	return pos;
+}
+
 // Set SDL_Rects and resolution
 void SetResolution(int res)
 {
@@ -287,6 +811,13 @@ bool Init()
 			// Create renderer for gWindow
 			gRenderer = SDL_CreateRenderer(gWindow, -1, SDL_RENDERER_ACCELERATED);
 
+			// No GPU, fall back to software rendering
+			if (gRenderer == NULL)
+			{
+				printf("Warning: Accelerated renderer not available, using software. SDL Error: %s\n", SDL_GetError());
+				gRenderer = SDL_CreateRenderer(gWindow, -1, SDL_RENDERER_SOFTWARE);
+			}
+
 			// Renderer failure
 			if (gRenderer == NULL)
 			{
@@ -309,6 +840,12 @@ bool Init()
 					printf("Failed to initialize SDL_image. SDL_image Error: %s\n", IMG_GetError());
 					success = false;
 				}
+
+				// Sound
+				InitAudio();
+
+				// Game records
+				if (stateTelemetry) StartTelemetry();
 			}
 		}
 	}
@@ -316,129 +853,2358 @@ bool Init()
 	return success;
 }
 
-// Load texture from file
-SDL_Texture* LoadTexture(std::string path)
+// Load texture from file
+SDL_Texture* LoadTexture(std::string path)
+{
+	TRACE_ZONE("Load texture");
+
+	// Final texture
+	SDL_Texture* newTexture = NULL;
+
+	// Load image to surface at specified path
+	SDL_Surface* loadedSurface = IMG_Load(path.c_str());
+
+	// Color key surface
+	SDL_SetColorKey(loadedSurface, SDL_TRUE, SDL_MapRGB(loadedSurface->format, 0, 0, 255));
+
+	// Failure
+	if (loadedSurface == NULL)
+	{
+		printf("Failed to load image %s. SDL_image Error: %s\n", path.c_str(), IMG_GetError());
+
+		return NULL;
+	}
+
+	// Success
+	else
+	{
+		// Create texture from surface
+		newTexture = SDL_CreateTextureFromSurface(gRenderer, loadedSurface);
+
+		// Failure
+		if (newTexture == NULL)
+		{
+			printf("Failed to create texture from %s. SDL Error: %s\n", path.c_str(), SDL_GetError());
+		}
+
+		// Free surface
+		SDL_FreeSurface(loadedSurface);
+	}
+
+	return newTexture;
+}
+
+// Register texture as a new resource with one reference
+TextureHandle AddTexture(SDL_Texture* texture, SDL_Surface* surface, std::string name, int resourceClass)
+{
+	TextureResource Resource;
+	Resource.texture = texture;
+	Resource.surface = surface;
+	Resource.name = name;
+	Resource.resourceClass = resourceClass;
+	Resource.references = 1;
+	Resource.lastUsed = currentTime;
+
+	// Assume 32 bits per pixel
+	int w = 0, h = 0;
+	SDL_QueryTexture(texture, NULL, NULL, &w, &h);
+	Resource.bytes = w * h * 4;
+	textureBytes[resourceClass] += Resource.bytes;
+
+	// Reuse a released slot
+	for (size_t i = 0; i < gTextures.size(); ++i)
+	{
+		if (gTextures[i].references == 0)
+		{
+			gTextures[i] = Resource;
+			return TextureHandle(i);
+		}
+	}
+
+	gTextures.push_back(Resource);
+
+	return TextureHandle(gTextures.size() - 1);
+}
+
+// Load texture from file and store it as a sprite
+TextureHandle StoreTexture(std::string path)
+{
+	// Load texture
+	SDL_Texture* gTexture = NULL;
+	gTexture = LoadTexture(path);
+
+	// Failure
+	if (gTexture == NULL)
+	{
+		printf("Failed to load texture image.\n");
+		return -1;
+	}
+
+	// Add texture to storage
+	return AddTexture(gTexture, NULL, path, RESOURCE_SPRITE);
+}
+
+// Store generated surface as a rebuildable texture, takes ownership of surface
+TextureHandle StoreSurface(SDL_Surface* surface, std::string name, int resourceClass)
+{
+	// Failure
+	if (surface == NULL)
+	{
+		return -1;
+	}
+
+	SDL_Texture* gTexture = SDL_CreateTextureFromSurface(gRenderer, surface);
+
+	// Failure
+	if (gTexture == NULL)
+	{
+		printf("Failed to create texture %s. SDL Error: %s\n", name.c_str(), SDL_GetError());
+		SDL_FreeSurface(surface);
+		return -1;
+	}
+
+	TextureHandle handle = AddTexture(gTexture, surface, name, resourceClass);
+
+	// Make room under budget, new texture counts as used this frame
+	EnforceTextureBudget(0);
+
+	return handle;
+}
+
+// Get texture for rendering, rebuilds it if it was evicted
+SDL_Texture* GetTexture(TextureHandle handle)
+{
+	if (handle < 0 || handle >= int(gTextures.size())) return NULL;
+
+	TextureResource& Resource = gTextures[handle];
+	Resource.lastUsed = currentTime;
+
+	// Rebuild evicted texture from its surface
+	if (Resource.texture == NULL && Resource.surface != NULL)
+	{
+		EnforceTextureBudget(Resource.bytes);
+
+		Resource.texture = SDL_CreateTextureFromSurface(gRenderer, Resource.surface);
+		if (Resource.texture != NULL) textureBytes[Resource.resourceClass] += Resource.bytes;
+	}
+
+	return Resource.texture;
+}
+
+// Add reference to texture
+void RetainTexture(TextureHandle handle)
+{
+	if (handle < 0 || handle >= int(gTextures.size())) return;
+
+	++gTextures[handle].references;
+}
+
+// Drop reference to texture, destroys it when none are left
+void ReleaseTexture(TextureHandle handle)
+{
+	if (handle < 0 || handle >= int(gTextures.size())) return;
+
+	TextureResource& Resource = gTextures[handle];
+	if (Resource.references == 0 || --Resource.references > 0) return;
+
+	if (Resource.texture != NULL)
+	{
+		SDL_DestroyTexture(Resource.texture);
+		textureBytes[Resource.resourceClass] -= Resource.bytes;
+		Resource.texture = NULL;
+	}
+
+	if (Resource.surface != NULL)
+	{
+		SDL_FreeSurface(Resource.surface);
+		Resource.surface = NULL;
+	}
+}
+
+// Drop one reference to every texture of a class
+void ReleaseTextures(int resourceClass)
+{
+	for (size_t i = 0; i < gTextures.size(); ++i)
+	{
+		if (gTextures[i].references > 0 && gTextures[i].resourceClass == resourceClass)
+			ReleaseTexture(TextureHandle(i));
+	}
+}
+
+// Evict least recently used rebuildable textures until given bytes more fit in budget
+void EnforceTextureBudget(int bytes)
+{
+	while (true)
+	{
+		int total = 0;
+		for (int i = 0; i < RESOURCE_CLASS_SIZE; ++i) total += textureBytes[i];
+
+		if (total + bytes <= textureBudget) return;
+
+		// Find oldest resident texture that can be rebuilt and was not used this frame
+		int oldest = -1;
+		for (size_t i = 0; i < gTextures.size(); ++i)
+		{
+			const TextureResource& Resource = gTextures[i];
+
+			if (Resource.texture != NULL && Resource.surface != NULL && Resource.lastUsed < currentTime
+				&& (oldest < 0 || Resource.lastUsed < gTextures[oldest].lastUsed))
+				oldest = int(i);
+		}
+
+		// Nothing left to evict
+		if (oldest < 0) return;
+
+		SDL_DestroyTexture(gTextures[oldest].texture);
+		gTextures[oldest].texture = NULL;
+		textureBytes[gTextures[oldest].resourceClass] -= gTextures[oldest].bytes;
+	}
+}
+
+// Print resident texture bytes per resource class
+void PrintTextureStats()
+{
+	const char* classNames[RESOURCE_CLASS_SIZE] = { "sprite", "grass" };
+
+	printf("Textures resident:\n");
+	for (int i = 0; i < RESOURCE_CLASS_SIZE; ++i)
+	{
+		printf("  %-8s %10d bytes\n", classNames[i], textureBytes[i]);
+	}
+}
+
+// Generate random field of grass
+SDL_Surface* GenerateGrass()
+{
+	// Load source texture
+	SDL_Surface* gGrass = IMG_Load("grass.png");
+
+	// Failure
+	if (gGrass == NULL)
+	{
+		printf("Failed to load texture image.\n");
+		return NULL;
+	}
+
+	// Success
+	else
+	{
+		// Destination surface
+		SDL_Surface* gGrassField = SDL_CreateRGBSurface(NULL, int(BASE_WIDTH), int(BASE_HEIGHT), 24, 0, 0, 0, 255);
+
+		// Source of grass patch
+		SDL_Rect RectGrassSource;
+		RectGrassSource.x = 0;
+		RectGrassSource.y = 0;
+		RectGrassSource.w = 32;
+		RectGrassSource.h = 32;
+
+		// Destination of grass patch
+		SDL_Rect RectGrassDest;
+		RectGrassDest.x = 0;
+		RectGrassDest.y = 0;
+		RectGrassDest.w = 32;
+		RectGrassDest.h = 32;
+
+		// Place 32x32 patches of grass on destination surface
+		for (int y = 0; y < 8; ++y)
+		{
+			RectGrassDest.y = y * 32;
+
+			for (int x = 0; x < 10; ++x)
+			{
+				RectGrassSource.x = RandomRange(RANDOM_GRASS, 8) * 32;
+				RectGrassDest.x = x * 32;
+				SDL_BlitSurface(gGrass, &RectGrassSource, gGrassField, &RectGrassDest);
+			}
+		}
+
+		// Free source
+		SDL_FreeSurface(gGrass);
+
+		return gGrassField;
+	}
+}
+
+// Advance game logic by one tick, replay takes input and apple from the rewind buffer
+void UpdateGame(bool replay)
+{
+	// Keyframe before first tick of each interval
+	if (!replay && rewindTick % rewindInterval == 0)
+		SaveKeyframe(rewindTick / rewindInterval % rewindKeyframes);
+
+	TickDelta& Delta = rewindDelta[rewindTick % (rewindInterval * rewindKeyframes)];
+
+	// State of transition and the move this tick makes from it
+	if (!replay && stateExport) EncodeObservation(exportObservation);
+	int action = snakeDirection;
+
+	// Decrement 'timer' for snake parts (element 0) of last tick unless apple eaten
+	if (!appleEaten)
+	{
+		for (int y = 0; y < BOARD_HEIGHT; ++y)
+		{
+			for (int x = 0; x < BOARD_WIDTH; ++x)
+			{
+				if (Snake[y][x][0] > 0)
+				{
+					--Snake[y][x][0];
+
+					// Tail left the cell
+					if (Snake[y][x][0] == 0) FreeCell(x, y);
+				}
+			}
+		}
+	}
+
+	appleEaten = false;
+
+	// Set 'timer' for snake part (element 0)
+	if (Snake[snakePosY][snakePosX][0] == 0 && Level[snakePosY][snakePosX] != TILE_WALL)
+	{
+		Snake[snakePosY][snakePosX][0] = snakeLength;
+		FillCell(snakePosX, snakePosY);
+	}
+
+	// Jump over snake condition goes here
+	// else if (snake is jumping) --> set element 3 to appropriate tile // Not implemented yet
+
+	// If square was not empty, snake crawled into itself or a wall
+	else
+	{
+		stateGameOver = true;
+		stateGameRunning = false;
+
+		positionGameOver = -32;
+		velocityGameOver = 0;
+		if (!replay)
+		{
+			PlaySound(SOUND_GAMEOVER);
+			EndGameTelemetry(END_CRASH);
+		}
+		loseTime = currentTime;
+		lastGameOverTime = currentTime;
+	}
+
+	// Set correct snake sprite (element 1)
+	if (snakeDirection == snakeDirectionLast)
+	{
+		if (snakeDirection < 2) Snake[snakePosY][snakePosX][1] = 0;
+		else Snake[snakePosY][snakePosX][1] = 1;
+	}
+	else if (snakeDirectionLast == UP) Snake[snakePosY][snakePosX][1] = 2 + snakeDirection;
+	else if (snakeDirectionLast == DOWN) Snake[snakePosY][snakePosX][1] = 4 + snakeDirection;
+	else if (snakeDirectionLast == LEFT) Snake[snakePosY][snakePosX][1] = 7 - (snakeDirection * 2);
+	else Snake[snakePosY][snakePosX][1] = 6 - (snakeDirection * 2);
+
+	// Set direction (element 2)
+	Snake[snakePosY][snakePosX][2] = snakeDirection;
+
+	// Remember direction faced at start
+	snakeDirectionLast = snakeDirection;
+
+	// Control and movement
+	switch (snakeDirection)
+	{
+	case UP:
+		snakePosY--;
+		if (userLeft || userPressedLeft) snakeDirection = LEFT;
+		else if (userRight || userPressedRight) snakeDirection = RIGHT;
+		break;
+
+	case DOWN:
+		snakePosY++;
+		if (userLeft || userPressedLeft) snakeDirection = LEFT;
+		else if (userRight || userPressedRight) snakeDirection = RIGHT;
+		break;
+
+	case LEFT:
+		snakePosX--;
+		if (userUp || userPressedUp) snakeDirection = UP;
+		else if (userDown || userPressedDown) snakeDirection = DOWN;
+		break;
+
+	case RIGHT:
+		snakePosX++;
+		if (userUp || userPressedUp) snakeDirection = UP;
+		else if (userDown || userPressedDown) snakeDirection = DOWN;
+		break;
+
+	default:
+		break;
+	}
+
+	// Replay recorded turn
+	if (replay) snakeDirection = Delta.direction;
+
+	// Warp around
+
+	// X wrap
+	snakePosX = Wrap<BOARD_WIDTH>(snakePosX);
+
+	// Y wrap
+	snakePosY = Wrap<BOARD_HEIGHT>(snakePosY);
+
+	// Portal to partner cell
+	if (Level[snakePosY][snakePosX] == TILE_PORTAL)
+	{
+		int partner = levelPortal[snakePosY * BOARD_WIDTH + snakePosX];
+		snakePosX = partner % BOARD_WIDTH;
+		snakePosY = partner / BOARD_WIDTH;
+	}
+
+	// Collect apple
+	if (applePosX == snakePosX && applePosY == snakePosY)
+	{
+		appleEaten = true;
+		++snakeLength;
+
+		if (!replay)
+		{
+			PlaySound(SOUND_EAT);
+			RecordTelemetry(EVENT_APPLE);
+		}
+
+		// Find new place for apple, same on replay as the stream position is restored
+		PlaceApple();
+	}
+
+	if (!replay)
+	{
+		// Bot picks turn of next tick from the board after this one
+		if (botThread != NULL && stateGameRunning) snakeDirection = BotTurn();
+
+		// Turned, recorded like apples at the head cell after wrap and portal
+		if (snakeDirection != snakeDirectionLast && !stateGameOver)
+		{
+			PlaySound(SOUND_TURN);
+			RecordTelemetry(EVENT_TURN);
+		}
+	}
+
+	++rewindTick;
+
+	if (replay) return;
+
+	if (rewindTick > rewindRecorded) rewindRecorded = rewindTick;
+
+	// Record input
+	Delta.direction = snakeDirection;
+
+	// Export transition, the crash is only detected next tick but belongs to this move
+	// Skip the tick that detects it, its record was already written as terminal
+	if (stateExport && !stateGameOver)
+	{
+		bool crash = Level[snakePosY][snakePosX] == TILE_WALL || Snake[snakePosY][snakePosX][0] > (appleEaten ? 0 : 1);
+		int flags = (exportEpisodeStart ? EXPORT_START : 0) | (crash ? EXPORT_DONE : 0);
+
+		ExportTransition(action, crash ? -1 : (appleEaten ? 1 : 0), flags);
+		exportEpisodeStart = false;
+	}
+
+	// Reset inputs
+	userPressedKey = false;
+	userPressedUp = false;
+	userPressedDown = false;
+	userPressedLeft = false;
+	userPressedRight = false;
+	userPressedEnter = false;
+	userPressedSpace = false;
+	userPressedEsc = false;
+}
+
+// Start random streams of a new game
+void SeedGame(Uint64 seed)
+{
+	gameSeed = seed;
+
+	for (int i = 0; i < RANDOM_SIZE; ++i)
+	{
+		randomCounter[i] = 0;
+	}
+}
+
+// Next number of a stream, a hash of seed, stream and counter so streams never interfere
+Uint32 Random(int stream)
+{
+	Uint64 z = gameSeed + (Uint64(stream) << 56) + ++randomCounter[stream] * 0x9E3779B97F4A7C15ull;
+
+	// SplitMix64 finalizer
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	z = z ^ (z >> 31);
+
+	return Uint32(z >> 32);
+}
+
+// Clear board and put snake and apple at their start
+void ResetGame()
+{
+	for (int y = 0; y < BOARD_HEIGHT; ++y)
+	{
+		for (int x = 0; x < BOARD_WIDTH; ++x)
+		{
+			Snake[y][x][0] = 0;
+			Snake[y][x][1] = 0;
+			Snake[y][x][2] = 0;
+			Snake[y][x][3] = 0;
+		}
+	}
+
+	freeDirty = true;
+
+	// Initialise variables
+	snakeLength = snakeLengthStart;
+	snakeDirection = RIGHT;
+	snakeDirectionLast = RIGHT;
+	snakePosX = snakeStartPosX;
+	snakePosY = snakeStartPosY;
+	appleEaten = false;
+	stateGameOver = false;
+	rewindTick = 0;
+	rewindRecorded = 0;
+	exportEpisodeStart = true;
+
+	// Place apple at start
+	PlaceApple();
+}
+
+// Random number in [0, n)
+Uint32 RandomRange(int stream, Uint32 n)
+{
+	return Uint32((Uint64(Random(stream)) * n) >> 32);
+}
+
+// Cell where apple may be placed
+bool AppleCell(int x, int y)
+{
+	if (Snake[y][x][0] != 0 || (x == snakePosX && y == snakePosY)) return false;
+
+	// Keep apples off walls and portals and out of regions the head cannot reach
+	if (stateLevel && (Level[y][x] != TILE_EMPTY || LevelDistance(snakePosX, snakePosY, x, y) == unreachable)) return false;
+
+	return true;
+}
+
+// Place apple on an allowed cell, one random number per placement
+void PlaceApple()
+{
+	// Count allowed cells
+	int freeCells = 0;
+	for (int y = 0; y < BOARD_HEIGHT; ++y)
+	{
+		for (int x = 0; x < BOARD_WIDTH; ++x)
+		{
+			freeCells += AppleCell(x, y);
+		}
+	}
+
+	if (freeCells <= 0) return;
+
+	// Pick n-th allowed cell
+	int pick = RandomRange(RANDOM_APPLE, freeCells);
+
+	for (int y = 0; y < BOARD_HEIGHT; ++y)
+	{
+		for (int x = 0; x < BOARD_WIDTH; ++x)
+		{
+			if (!AppleCell(x, y)) continue;
+
+			if (pick-- == 0)
+			{
+				applePosX = x;
+				applePosY = y;
+				return;
+			}
+		}
+	}
+}
+
+// Load level map, '#' is wall, a pair of equal letters is a portal, anything else is empty
+bool LoadLevel(std::string path)
+{
+	FILE* file = fopen(path.c_str(), "r");
+
+	// Failure
+	if (file == NULL)
+	{
+		printf("Failed to open level %s.\n", path.c_str());
+		return false;
+	}
+
+	// Read tiles, remembering first cell of each portal letter
+	int portalFirst[26];
+	for (int i = 0; i < 26; ++i) portalFirst[i] = -1;
+
+	char line[256];
+	for (int y = 0; y < BOARD_HEIGHT; ++y)
+	{
+		if (fgets(line, sizeof(line), file) == NULL) line[0] = '\0';
+
+		bool ended = false;
+		for (int x = 0; x < BOARD_WIDTH; ++x)
+		{
+			int cell = y * BOARD_WIDTH + x;
+			char c = ended ? '.' : line[x];
+			if (c == '\0' || c == '\n' || c == '\r') { ended = true; c = '.'; }
+
+			Level[y][x] = TILE_EMPTY;
+			levelPortal[cell] = -1;
+
+			if (c == '#') Level[y][x] = TILE_WALL;
+
+			else if (c >= 'A' && c <= 'Z')
+			{
+				int letter = c - 'A';
+
+				if (portalFirst[letter] < 0) portalFirst[letter] = cell;
+
+				else if (levelPortal[portalFirst[letter]] < 0)
+				{
+					levelPortal[cell] = short(portalFirst[letter]);
+					levelPortal[portalFirst[letter]] = short(cell);
+					Level[y][x] = TILE_PORTAL;
+					Level[portalFirst[letter] / BOARD_WIDTH][portalFirst[letter] % BOARD_WIDTH] = TILE_PORTAL;
+				}
+			}
+		}
+	}
+
+	fclose(file);
+
+	// Failure, every game would crash or teleport on its first tick, play without a level
+	if (Level[snakeStartPosY][snakeStartPosX] != TILE_EMPTY)
+	{
+		printf("Level %s blocks the snake start position.\n", path.c_str());
+
+		memset(Level, TILE_EMPTY, sizeof(Level));
+		for (int i = 0; i < BOARD_HEIGHT * BOARD_WIDTH; ++i) levelPortal[i] = -1;
+
+		return false;
+	}
+
+	// Distance field from cache, or build and cache it
+	Uint64 hash = HashLevel();
+
+	if (!LoadDistances(hash))
+	{
+		BuildDistances();
+		SaveDistances(hash);
+	}
+
+	stateLevel = true;
+	freeDirty = true;
+
+	return true;
+}
+
+// Cell reached by moving from cell in direction, through edges and portals, or -1 for wall
+int StepCell(int cell, int direction)
+{
+	int x = Wrap<BOARD_WIDTH>(cell % BOARD_WIDTH + directionX[direction]);
+	int y = Wrap<BOARD_HEIGHT>(cell / BOARD_WIDTH + directionY[direction]);
+
+	if (Level[y][x] == TILE_WALL) return -1;
+
+	int next = y * BOARD_WIDTH + x;
+	if (Level[y][x] == TILE_PORTAL) next = levelPortal[next];
+
+	return next;
+}
+
+// FNV-1a hash of level tiles and portal pairs, keys the distance cache
+Uint64 HashLevel()
+{
+	Uint64 hash = 0xCBF29CE484222325ull;
+	const int cells = BOARD_HEIGHT * BOARD_WIDTH;
+
+	for (int i = 0; i < cells; ++i)
+	{
+		hash = (hash ^ Level[i / BOARD_WIDTH][i % BOARD_WIDTH]) * 0x100000001B3ull;
+		hash = (hash ^ Uint16(levelPortal[i])) * 0x100000001B3ull;
+	}
+
+	return hash;
+}
+
+// Breadth first search from every cell
+void BuildDistances()
+{
+	const int cells = BOARD_HEIGHT * BOARD_WIDTH;
+	levelDistance.assign(cells * cells, unreachable);
+
+	std::vector<int> queue(cells);
+
+	for (int from = 0; from < cells; ++from)
+	{
+		if (Level[from / BOARD_WIDTH][from % BOARD_WIDTH] == TILE_WALL) continue;
+
+		Uint16* distance = &levelDistance[from * cells];
+		int head = 0, tail = 0;
+
+		distance[from] = 0;
+		queue[tail++] = from;
+
+		while (head < tail)
+		{
+			int cell = queue[head++];
+
+			for (int direction = UP; direction <= RIGHT; ++direction)
+			{
+				int next = StepCell(cell, direction);
+
+				if (next >= 0 && distance[next] == unreachable)
+				{
+					distance[next] = distance[cell] + 1;
+					queue[tail++] = next;
+				}
+			}
+		}
+	}
+}
+
+// Read distance field cached for level hash
+bool LoadDistances(Uint64 hash)
+{
+	char path[64];
+	sprintf(path, "level_%016llx.dist", (unsigned long long)hash);
+
+	FILE* file = fopen(path, "rb");
+	if (file == NULL) return false;
+
+	const int cells = BOARD_HEIGHT * BOARD_WIDTH;
+	Uint64 fileHash = 0;
+	Uint32 fileCells = 0;
+
+	bool success = fread(&fileHash, 8, 1, file) == 1 && fread(&fileCells, 4, 1, file) == 1
+		&& fileHash == hash && fileCells == Uint32(cells);
+
+	if (success)
+	{
+		levelDistance.resize(cells * cells);
+		success = fread(levelDistance.data(), 2, cells * cells, file) == size_t(cells * cells);
+	}
+
+	fclose(file);
+
+	return success;
+}
+
+// Cache distance field for level hash
+void SaveDistances(Uint64 hash)
+{
+	char path[64];
+	sprintf(path, "level_%016llx.dist", (unsigned long long)hash);
+
+	FILE* file = fopen(path, "wb");
+
+	// Failure is harmless, distances are rebuilt next time
+	if (file == NULL) return;
+
+	Uint32 cells = BOARD_HEIGHT * BOARD_WIDTH;
+	fwrite(&hash, 8, 1, file);
+	fwrite(&cells, 4, 1, file);
+	fwrite(levelDistance.data(), 2, cells * cells, file);
+	fclose(file);
+}
+
+// Moves between two cells, unreachable when walls separate them
+int LevelDistance(int fromX, int fromY, int toX, int toY)
+{
+	const int cells = BOARD_HEIGHT * BOARD_WIDTH;
+
+	return levelDistance[(fromY * BOARD_WIDTH + fromX) * cells + toY * BOARD_WIDTH + toX];
+}
+
+// Load bot plugin and start its worker thread
+bool LoadBot(const char* path)
+{
+	botObject = SDL_LoadObject(path);
+
+	// Failure
+	if (botObject == NULL)
+	{
+		printf("Failed to load bot %s! SDL Error: %s\n", path, SDL_GetError());
+		return false;
+	}
+
+	BotAbiFunction botAbi = (BotAbiFunction)SDL_LoadFunction(botObject, "snek_bot_abi");
+	botDecide = (BotDecideFunction)SDL_LoadFunction(botObject, "snek_bot_decide");
+
+	// Failure
+	if (botAbi == NULL || botDecide == NULL || botAbi() != SNEK_BOT_ABI)
+	{
+		printf("Bot %s does not implement bot ABI version %d.\n", path, SNEK_BOT_ABI);
+		SDL_UnloadObject(botObject);
+		botObject = NULL;
+		botDecide = NULL;
+		return false;
+	}
+
+	// Board view points into game memory, the rest is filled each tick
+	botBoard.width = BOARD_WIDTH;
+	botBoard.height = BOARD_HEIGHT;
+	botBoard.cells = &Snake[0][0][0];
+	botBoard.level = &Level[0][0];
+	botBoard.portal = levelPortal;
+
+	SDL_AtomicSet(&botQuit, 0);
+
+	botRequest = SDL_CreateSemaphore(0);
+	botReply = SDL_CreateSemaphore(0);
+	botThread = SDL_CreateThread(BotWorker, "BotWorker", NULL);
+
+	return true;
+}
+
+// Worker thread, calls the bot for each request
+int BotWorker(void* data)
+{
+	for (;;)
+	{
+		SDL_SemWait(botRequest);
+
+		if (SDL_AtomicGet(&botQuit)) break;
+
+		botResult = botDecide(&botBoard);
+		botEnd = SDL_GetPerformanceCounter();
+
+		SDL_SemPost(botReply);
+	}
+
+	return 0;
+}
+
+// No decision outstanding, collects a late answer, keeps its latency and drops its move
+bool BotIdle()
+{
+	if (botBusy && SDL_SemTryWait(botReply) == 0)
+	{
+		botBusy = false;
+		RecordBotLatency();
+	}
+
+	return !botBusy;
+}
+
+// Ask bot for the next direction, straight ahead if it misses the deadline or answers nonsense
+// Only called while the bot is idle
+int BotTurn()
+{
+	int turn = snakeDirectionLast;
+
+	botBoard.headX = snakePosX;
+	botBoard.headY = snakePosY;
+	botBoard.appleX = applePosX;
+	botBoard.appleY = applePosY;
+	botBoard.direction = snakeDirectionLast;
+	botBoard.length = snakeLength;
+
+	botStart = SDL_GetPerformanceCounter();
+
+	SDL_SemPost(botRequest);
+
+	if (SDL_SemWaitTimeout(botReply, botDeadline) == SDL_MUTEX_TIMEDOUT)
+	{
+		botBusy = true;
+		++botTimeouts;
+		return turn;
+	}
+
+	RecordBotLatency();
+
+	// Turning back is not a move
+	if (botResult >= UP && botResult <= RIGHT && botResult != (snakeDirectionLast ^ 1)) turn = botResult;
+
+	return turn;
+}
+
+// Store latency of the answered decision
+void RecordBotLatency()
+{
+	botLatency[botDecisions++ % botLatencySize] = Uint32((botEnd - botStart) * 1000000 / SDL_GetPerformanceFrequency());
+}
+
+// Print latency percentiles of recent bot decisions
+void PrintBotStats()
+{
+	if (botDecisions == 0) return;
+
+	// Sort a copy, no allocation so it is safe during gameplay
+	static Uint32 sorted[botLatencySize];
+	int count = int(std::min(botDecisions, unsigned(botLatencySize)));
+	std::copy(botLatency, botLatency + count, sorted);
+	std::sort(sorted, sorted + count);
+
+	int last = count - 1;
+
+	printf("Bot: %u decisions, %u timeouts, %u frames held, latency us p50 %u p90 %u p99 %u max %u\n",
+		botDecisions, botTimeouts, botHeld, sorted[last * 50 / 100], sorted[last * 90 / 100], sorted[last * 99 / 100], sorted[last]);
+}
+
+// Stop worker thread and unload bot
+void StopBot()
+{
+	if (botThread == NULL) return;
+
+	// A bot stuck in a decision cannot be joined, leave it and its code alone
+	if (botBusy && SDL_SemWaitTimeout(botReply, botDeadline) == SDL_MUTEX_TIMEDOUT)
+	{
+		PrintBotStats();
+		printf("Warning: Bot did not return, abandoning it.\n");
+		SDL_DetachThread(botThread);
+		botThread = NULL;
+		return;
+	}
+
+	// Late answer made it in the end
+	if (botBusy)
+	{
+		botBusy = false;
+		RecordBotLatency();
+	}
+
+	PrintBotStats();
+
+	SDL_AtomicSet(&botQuit, 1);
+	SDL_SemPost(botRequest);
+	SDL_WaitThread(botThread, NULL);
+	botThread = NULL;
+
+	SDL_DestroySemaphore(botRequest);
+	SDL_DestroySemaphore(botReply);
+	botRequest = NULL;
+	botReply = NULL;
+
+	SDL_UnloadObject(botObject);
+	botObject = NULL;
+	botDecide = NULL;
+}
+
+// Cell is neither snake nor wall
+bool CellFree(int cell)
+{
+	int x = cell % BOARD_WIDTH, y = cell / BOARD_WIDTH;
+
+	return Snake[y][x][0] == 0 && Level[y][x] != TILE_WALL;
+}
+
+// Root of cell's region, halving the path on the way
+int FreeRoot(int cell)
+{
+	while (freeParent[cell] != cell)
+	{
+		freeParent[cell] = freeParent[freeParent[cell]];
+		cell = freeParent[cell];
+	}
+
+	return cell;
+}
+
+// Merge regions of two cells, smaller under larger
+void FreeUnion(int a, int b)
+{
+	a = FreeRoot(a);
+	b = FreeRoot(b);
+
+	if (a == b) return;
+
+	if (freeSize[a] < freeSize[b]) std::swap(a, b);
+
+	freeParent[b] = short(a);
+	freeSize[a] += freeSize[b];
+}
+
+// Regions from scratch, portals count as links both ways
+void RebuildRegions()
+{
+	const int cells = BOARD_HEIGHT * BOARD_WIDTH;
+
+	for (int cell = 0; cell < cells; ++cell)
+	{
+		freeParent[cell] = short(cell);
+		freeSize[cell] = CellFree(cell);
+		freeGhost[cell] = false;
+	}
+
+	for (int cell = 0; cell < cells; ++cell)
+	{
+		if (!CellFree(cell)) continue;
+
+		for (int direction = UP; direction <= RIGHT; ++direction)
+		{
+			int next = StepCell(cell, direction);
+			if (next >= 0 && CellFree(next)) FreeUnion(cell, next);
+		}
+	}
+
+	freeDirty = false;
+	++freeRebuilds;
+}
+
+// Cell became free, joins the regions around it
+void FreeCell(int x, int y)
+{
+	if (freeDirty) return;
+
+	int cell = y * BOARD_WIDTH + x;
+
+	// Portals link cells one way only, leave cells next to them to a rebuild
+	for (int direction = UP; direction <= RIGHT; ++direction)
+	{
+		if (Level[y][x] == TILE_PORTAL || Level[Wrap<BOARD_HEIGHT>(y + directionY[direction])][Wrap<BOARD_WIDTH>(x + directionX[direction])] == TILE_PORTAL)
+		{
+			freeDirty = true;
+			return;
+		}
+	}
+
+	// A ghost still roots or links part of its old tree, it may only rejoin it through a neighbour in that tree
+	if (freeGhost[cell])
+	{
+		int root = FreeRoot(cell);
+		bool rejoined = false;
+
+		for (int direction = UP; direction <= RIGHT; ++direction)
+		{
+			int next = StepCell(cell, direction);
+			if (next >= 0 && CellFree(next) && FreeRoot(next) == root) rejoined = true;
+		}
+
+		if (!rejoined)
+		{
+			freeDirty = true;
+			return;
+		}
+
+		freeGhost[cell] = false;
+		++freeSize[root];
+	}
+
+	else
+	{
+		freeParent[cell] = short(cell);
+		freeSize[cell] = 1;
+	}
+
+	for (int direction = UP; direction <= RIGHT; ++direction)
+	{
+		int next = StepCell(cell, direction);
+		if (next >= 0 && CellFree(next)) FreeUnion(cell, next);
+	}
+}
+
+// Cell was filled, its region shrinks unless it may split
+void FillCell(int x, int y)
+{
+	if (freeDirty) return;
+
+	int cell = y * BOARD_WIDTH + x;
+
+	// Walk the 8 cells around clockwise from above, the region cannot split if the free
+	// orthogonal neighbours all lie on one run of free ring cells
+	const int ringX[8] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+	const int ringY[8] = { -1, -1, 0, 1, 1, 1, 0, -1 };
+	bool ring[8];
+	int freeRing = 0;
+
+	for (int i = 0; i < 8; ++i)
+	{
+		int ringCellX = Wrap<BOARD_WIDTH>(x + ringX[i]);
+		int ringCellY = Wrap<BOARD_HEIGHT>(y + ringY[i]);
+
+		// Portals link far cells, the ring says nothing about them
+		if (Level[ringCellY][ringCellX] == TILE_PORTAL || Level[y][x] == TILE_PORTAL)
+		{
+			freeDirty = true;
+			return;
+		}
+
+		ring[i] = CellFree(ringCellY * BOARD_WIDTH + ringCellX);
+		freeRing += ring[i];
+	}
+
+	int runs = 0;
+
+	if (freeRing == 8) runs = 1;
+
+	else if (freeRing > 0)
+	{
+		// Start after a filled ring cell so no run is cut at the end
+		int start = 0;
+		while (ring[start]) ++start;
+
+		bool inRun = false, orthogonal = false;
+
+		for (int k = 1; k <= 8; ++k)
+		{
+			int i = (start + k) % 8;
+
+			if (ring[i])
+			{
+				inRun = true;
+				orthogonal |= i % 2 == 0;
+			}
+
+			else if (inRun)
+			{
+				runs += orthogonal;
+				inRun = false;
+				orthogonal = false;
+			}
+		}
+	}
+
+	if (runs > 1)
+	{
+		freeDirty = true;
+		return;
+	}
+
+	freeGhost[cell] = true;
+	--freeSize[FreeRoot(cell)];
+}
+
+// Free cells in the region of a cell, 0 if it is not free
+int RegionSize(int x, int y)
+{
+	int cell = y * BOARD_WIDTH + x;
+
+	if (!CellFree(cell)) return 0;
+
+	if (freeDirty) RebuildRegions();
+
+	return freeSize[FreeRoot(cell)];
+}
+
+// Both cells are free and in the same region
+bool RegionsConnected(int fromX, int fromY, int toX, int toY)
+{
+	int from = fromY * BOARD_WIDTH + fromX;
+	int to = toY * BOARD_WIDTH + toX;
+
+	if (!CellFree(from) || !CellFree(to)) return false;
+
+	if (freeDirty) RebuildRegions();
+
+	return FreeRoot(from) == FreeRoot(to);
+}
+
+// Region size by flood fill, reference for RegionSize, follows portals both ways like the union-find
+int FloodRegionSize(int x, int y)
+{
+	const int cells = BOARD_HEIGHT * BOARD_WIDTH;
+	int cell = y * BOARD_WIDTH + x;
+
+	if (!CellFree(cell)) return 0;
+
+	bool visited[cells] = {};
+	int queue[cells];
+	int head = 0, tail = 0;
+
+	visited[cell] = true;
+	queue[tail++] = cell;
+
+	while (head < tail)
+	{
+		cell = queue[head++];
+
+		for (int direction = UP; direction <= RIGHT; ++direction)
+		{
+			int next = StepCell(cell, direction);
+
+			if (next >= 0 && !visited[next] && CellFree(next))
+			{
+				visited[next] = true;
+				queue[tail++] = next;
+			}
+
+			// A portal beside steps out into this cell
+			int besideX = Wrap<BOARD_WIDTH>(cell % BOARD_WIDTH + directionX[direction]);
+			int beside = Wrap<BOARD_HEIGHT>(cell / BOARD_WIDTH + directionY[direction]) * BOARD_WIDTH + besideX;
+
+			if (Level[beside / BOARD_WIDTH][besideX] == TILE_PORTAL && !visited[beside] && CellFree(beside))
+			{
+				visited[beside] = true;
+				queue[tail++] = beside;
+			}
+
+			// Cells stepping into the partner portal arrive here
+			if (Level[cell / BOARD_WIDTH][cell % BOARD_WIDTH] != TILE_PORTAL) continue;
+
+			int partner = levelPortal[cell];
+			int backX = Wrap<BOARD_WIDTH>(partner % BOARD_WIDTH + directionX[direction]);
+			int back = Wrap<BOARD_HEIGHT>(partner / BOARD_WIDTH + directionY[direction]) * BOARD_WIDTH + backX;
+
+			if (!visited[back] && CellFree(back))
+			{
+				visited[back] = true;
+				queue[tail++] = back;
+			}
+		}
+	}
+
+	return tail;
+}
+
+// Random snake walk comparing RegionSize with flood fill around the head each tick
+void BenchRegions(int ticks)
+{
+	SeedGame(seedOption != 0 ? seedOption : 1);
+
+	Uint64 timeRegions = 0, timeFlood = 0;
+	int queries = 0, mismatches = 0, sum = 0, games = 0;
+	int headX = 0, headY = 0, length = 0, lastDirection = RIGHT;
+
+	for (int tick = 0; tick < ticks; ++tick)
+	{
+		// New game on an empty board
+		if (length == 0)
+		{
+			memset(Snake, 0, sizeof(Snake));
+			freeDirty = true;
+
+			headX = snakeStartPosX;
+			headY = snakeStartPosY;
+			length = snakeLengthStart;
+			lastDirection = RIGHT;
+			++games;
+		}
+
+		// Same order of updates as UpdateGame
+		Uint64 start = SDL_GetPerformanceCounter();
+
+		for (int y = 0; y < BOARD_HEIGHT; ++y)
+		{
+			for (int x = 0; x < BOARD_WIDTH; ++x)
+			{
+				if (Snake[y][x][0] > 0)
+				{
+					--Snake[y][x][0];
+					if (Snake[y][x][0] == 0) FreeCell(x, y);
+				}
+			}
+		}
+
+		Snake[headY][headX][0] = Uint8(length);
+		FillCell(headX, headY);
+
+		// Region beside the head in every direction
+		int head = headY * BOARD_WIDTH + headX;
+		int region[4];
+
+		for (int direction = UP; direction <= RIGHT; ++direction)
+		{
+			int next = StepCell(head, direction);
+			region[direction] = next >= 0 ? RegionSize(next % BOARD_WIDTH, next / BOARD_WIDTH) : 0;
+		}
+
+		timeRegions += SDL_GetPerformanceCounter() - start;
+		start = SDL_GetPerformanceCounter();
+
+		for (int direction = UP; direction <= RIGHT; ++direction)
+		{
+			int next = StepCell(head, direction);
+			int flood = next >= 0 ? FloodRegionSize(next % BOARD_WIDTH, next / BOARD_WIDTH) : 0;
+
+			mismatches += flood != region[direction];
+			sum += flood;
+			++queries;
+		}
+
+		timeFlood += SDL_GetPerformanceCounter() - start;
+
+		// Random move into a free cell, game ends when there is none
+		int moves[4], count = 0;
+
+		for (int direction = UP; direction <= RIGHT; ++direction)
+		{
+			int next = StepCell(head, direction);
+			if (direction != (lastDirection ^ 1) && next >= 0 && CellFree(next)) moves[count++] = direction;
+		}
+
+		if (count == 0)
+		{
+			length = 0;
+			continue;
+		}
+
+		lastDirection = moves[RandomRange(RANDOM_APPLE, count)];
+		head = StepCell(head, lastDirection);
+		headX = head % BOARD_WIDTH;
+		headY = head / BOARD_WIDTH;
+
+		// Grow now and then like eating apples
+		if (tick % 8 == 0 && length < 255) ++length;
+	}
+
+	double frequency = double(SDL_GetPerformanceFrequency());
+
+	printf("Regions: %d ticks, %d games, %d queries, %u rebuilds, %d mismatches (checksum %d)\n",
+		ticks, games, queries, freeRebuilds, mismatches, sum);
+	printf("  incremental %8.1f ns per tick\n", timeRegions * 1e9 / frequency / ticks);
+	printf("  flood fill  %8.1f ns per tick\n", timeFlood * 1e9 / frequency / ticks);
+}
+
+// Render snake tile from RectSnakeSource at fractional board position, wrapping across edges
+void RenderTile(SDL_Texture* texture, double x, double y)
+{
+	for (int wrapY = -1; wrapY <= 1; ++wrapY)
+	{
+		double tileY = y + wrapY * BOARD_HEIGHT;
+		if (tileY <= -1.0 || tileY >= BOARD_HEIGHT) continue;
+
+		for (int wrapX = -1; wrapX <= 1; ++wrapX)
+		{
+			double tileX = x + wrapX * BOARD_WIDTH;
+			if (tileX <= -1.0 || tileX >= BOARD_WIDTH) continue;
+
+			RectSnakeDest.x = int(floor(tileX * (16.0 / BASE_WIDTH) * screenWidth));
+			RectSnakeDest.y = int(floor(tileY * (16.0 / BASE_HEIGHT) * screenHeight));
+			SDL_RenderCopy(gRenderer, texture, &RectSnakeSource, &RectSnakeDest);
+		}
+	}
+}
+
+// Save current game state into keyframe slot
+void SaveKeyframe(int slot)
+{
+	GameState& State = rewindKeyframe[slot];
+
+	memcpy(State.snake, Snake, sizeof(Snake));
+	State.length = snakeLength;
+	State.direction = snakeDirection;
+	State.directionLast = snakeDirectionLast;
+	State.posX = snakePosX;
+	State.posY = snakePosY;
+	State.appleX = applePosX;
+	State.appleY = applePosY;
+	State.appleEaten = appleEaten;
+	State.appleCounter = randomCounter[RANDOM_APPLE];
+}
+
+// Restore game state from keyframe slot
+void LoadKeyframe(int slot)
+{
+	const GameState& State = rewindKeyframe[slot];
+
+	memcpy(Snake, State.snake, sizeof(Snake));
+	snakeLength = State.length;
+	snakeDirection = State.direction;
+	snakeDirectionLast = State.directionLast;
+	snakePosX = State.posX;
+	snakePosY = State.posY;
+	applePosX = State.appleX;
+	applePosY = State.appleY;
+	appleEaten = State.appleEaten;
+	randomCounter[RANDOM_APPLE] = State.appleCounter;
+
+	freeDirty = true;
+}
+
+// Oldest tick still covered by the rewind buffer, counted from the newest tick ever recorded
+unsigned int OldestRewindTick()
+{
+	if (rewindRecorded == 0) return 0;
+
+	unsigned int newest = (rewindRecorded - 1) / rewindInterval;
+
+	if (newest < unsigned(rewindKeyframes)) return 0;
+	return (newest - rewindKeyframes + 1) * rewindInterval;
+}
+
+// Restore game to the state before given tick, later ticks are discarded
+bool SeekGame(unsigned int tick)
+{
+	if (tick > rewindTick || tick < OldestRewindTick()) return false;
+
+	// Already there, the keyframe of a tick that has not started yet is not saved
+	if (tick == rewindTick) return true;
+
+	// Nearest keyframe at or before tick
+	unsigned int keyframe = tick / rewindInterval;
+	LoadKeyframe(keyframe % rewindKeyframes);
+
+	// Re-simulate at most rewindInterval - 1 ticks
+	rewindTick = keyframe * rewindInterval;
+	while (rewindTick < tick) UpdateGame(true);
+
+	// Forget what happened after tick, exported play continues as a new episode
+	TruncateTelemetry(tick);
+	exportEpisodeStart = true;
+
+	return true;
+}
+
+// Start next shard file of this session
+bool OpenShard()
+{
+	char path[64];
+	sprintf(path, "transitions_%u_%04d.bin", exportSession, exportShard);
+
+	exportFile = fopen(path, "wb");
+
+	// Failure
+	if (exportFile == NULL)
+	{
+		printf("Failed to open %s for writing.\n", path);
+		stateExport = false;
+		return false;
+	}
+
+	// Header is rewritten with the final record count on close
+	memset(&exportHeader, 0, sizeof(exportHeader));
+	memcpy(exportHeader.magic, "SNKX", 4);
+	exportHeader.version = 3;
+	exportHeader.headerSize = sizeof(ShardHeader);
+	exportHeader.recordSize = observationSize + 3;
+	exportHeader.width = BOARD_WIDTH;
+	exportHeader.height = BOARD_HEIGHT;
+	exportHeader.planes = observationPlanes;
+	fwrite(&exportHeader, sizeof(exportHeader), 1, exportFile);
+
+	return true;
+}
+
+// Append transition record of observation, action, reward and ExportFlag bits
+// An episode runs from an EXPORT_START record up to the next one, without EXPORT_DONE it was cut short
+void ExportTransition(int action, int reward, int flags)
+{
+	if (exportFile == NULL && !OpenShard()) return;
+
+	Uint8 outcome[3] = { Uint8(action), Uint8(Sint8(reward)), Uint8(flags) };
+	fwrite(exportObservation, 1, observationSize, exportFile);
+	fwrite(outcome, 1, 3, exportFile);
+
+	// Shard full, move on to next
+	if (++exportHeader.records >= shardRecords)
+	{
+		CloseShard();
+		++exportShard;
+	}
+}
+
+// Write final header and close shard
+void CloseShard()
+{
+	if (exportFile == NULL) return;
+
+	fseek(exportFile, 0, SEEK_SET);
+	fwrite(&exportHeader, sizeof(exportHeader), 1, exportFile);
+	fclose(exportFile);
+	exportFile = NULL;
+}
+
+// Create shared memory region of the environment channel
+bool OpenEnvChannel(const char* name)
+{
+#ifdef _WIN32
+	envMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(EnvChannel), name);
+
+	if (envMapping != NULL) envChannel = (EnvChannel*)MapViewOfFile(envMapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(EnvChannel));
+#else
+	char path[256];
+	snprintf(path, sizeof(path), "/%s", name);
+
+	int file = shm_open(path, O_CREAT | O_RDWR, 0600);
+
+	if (file >= 0 && ftruncate(file, sizeof(EnvChannel)) == 0)
+	{
+		void* region = mmap(NULL, sizeof(EnvChannel), PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+		if (region != MAP_FAILED) envChannel = (EnvChannel*)region;
+	}
+
+	if (file >= 0) close(file);
+#endif
+
+	// Failure
+	if (envChannel == NULL)
+	{
+		printf("Failed to create shared memory %s for the environment server.\n", name);
+		return false;
+	}
+
+	// Counters first, magic last so a trainer attaching early waits for a clean region
+	memset(envChannel, 0, sizeof(EnvChannel));
+	envChannel->version = 2;
+	envChannel->slotSize = sizeof(EnvSlot);
+	envChannel->slots = envSlots;
+	envChannel->width = BOARD_WIDTH;
+	envChannel->height = BOARD_HEIGHT;
+	envChannel->planes = observationPlanes;
+	SDL_MemoryBarrierRelease();
+	memcpy(envChannel->magic, "SNKE", 4);
+
+	return true;
+}
+
+// Unmap and remove the shared memory region
+void CloseEnvChannel()
+{
+	if (envChannel == NULL) return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(envChannel);
+	CloseHandle(envMapping);
+	envMapping = NULL;
+#else
+	munmap(envChannel, sizeof(EnvChannel));
+
+	char path[256];
+	snprintf(path, sizeof(path), "/%s", envName);
+	shm_unlink(path);
+#endif
+
+	envChannel = NULL;
+}
+
+// Spin until the trainer answered step, then yield and finally sleep while it is idle, false when it quits
+bool WaitEnvAction(Uint32 step)
+{
+	for (Uint32 spin = 0; Uint32(SDL_AtomicGet(&envChannel->actions)) <= step; ++spin)
+	{
+		if (SDL_AtomicGet(&envChannel->quit)) return false;
+
+		if (spin > 1000) SDL_Delay(spin > 100000 ? 1 : 0);
+	}
+
+	return !SDL_AtomicGet(&envChannel->quit);
+}
+
+// Step games headless in lockstep with a trainer process through the environment channel
+void RunEnvServer()
+{
+	if (!OpenEnvChannel(envName)) return;
+
+	printf("Environment server on shared memory %s, %u bytes.\n", envName, unsigned(sizeof(EnvChannel)));
+
+	Uint64 seed = seedOption != 0 ? seedOption : SDL_GetPerformanceCounter();
+	Uint32 episodes = 0, step = 0;
+	Sint8 reward = 0;
+	Uint8 flags = EXPORT_START;
+
+	SeedGame(seed);
+	ResetGame();
+
+	Uint64 start = SDL_GetPerformanceCounter();
+
+	for (;;)
+	{
+		// Publish state of this step, the trainer reads it in place
+		EnvSlot& Slot = envChannel->slot[step % envSlots];
+		EncodeObservation(Slot.observation);
+		Slot.reward = reward;
+		Slot.flags = flags;
+		Slot.step = step;
+		SDL_AtomicSet(&envChannel->published, int(step + 1));
+
+		if (!WaitEnvAction(step)) break;
+
+		// Action turns the snake, turning back is not a move
+		int action = envChannel->action[step % envSlots];
+		if (action >= UP && action <= RIGHT && action != (snakeDirectionLast ^ 1)) snakeDirection = Uint8(action);
+
+		UpdateGame(false);
+		++step;
+
+		// Crash only shows next tick, end the episode on the move that causes it
+		bool crash = Level[snakePosY][snakePosX] == TILE_WALL || Snake[snakePosY][snakePosX][0] > (appleEaten ? 0 : 1);
+
+		reward = crash ? -1 : (appleEaten ? 1 : 0);
+		flags = 0;
+
+		// Next episode, its first observation carries the outcome of the last move
+		if (crash)
+		{
+			++episodes;
+			SeedGame(seed + episodes);
+			ResetGame();
+			flags = EXPORT_DONE | EXPORT_START;
+		}
+	}
+
+	double seconds = double(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+	printf("Environment server stopped after %u steps, %u episodes, %.0f steps per second.\n",
+		step, episodes, seconds > 0 ? step / seconds : 0.0);
+
+	CloseEnvChannel();
+}
+
+// Encode board as feature planes into observationSize bytes
+void EncodeObservation(Uint8* planes)
+{
+	const int cells = BOARD_HEIGHT * BOARD_WIDTH;
+
+	Uint8* body = planes;
+	Uint8* head = planes + cells;
+	Uint8* direction = planes + cells * 2;
+	Uint8* apple = planes + cells * 3;
+
+	for (int y = 0; y < BOARD_HEIGHT; ++y)
+	{
+		for (int x = 0; x < BOARD_WIDTH; ++x)
+		{
+			int i = y * BOARD_WIDTH + x;
+
+			// Remaining ticks of body part, 0 when free
+			body[i] = Snake[y][x][0];
+
+			// Direction of travel plus one, 0 when free
+			direction[i] = Snake[y][x][0] > 0 ? Snake[y][x][2] + 1 : 0;
+
+			head[i] = 0;
+			apple[i] = 0;
+		}
+	}
+
+	// Head and apple are single cells
+	head[snakePosY * BOARD_WIDTH + snakePosX] = 1;
+	// Head shows the direction it faces, the pending move is the action taken from this board
+	direction[snakePosY * BOARD_WIDTH + snakePosX] = snakeDirectionLast + 1;
+	apple[applePosY * BOARD_WIDTH + applePosX] = 1;
+}
+
+// Open audio device and prepare sound effects
+bool InitAudio()
+{
+	// Audio failure is not fatal, game just stays silent
+	if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0)
+	{
+		printf("Warning: Failed to initialize audio. SDL_Error: %s\n", SDL_GetError());
+		return false;
+	}
+
+	// Generate sound effects
+	GenerateSound(SOUND_EAT, 0.08, 600.0, 1200.0, false);
+	GenerateSound(SOUND_TURN, 0.02, 220.0, 220.0, true);
+	GenerateSound(SOUND_GAMEOVER, 0.6, 440.0, 110.0, true);
+	GenerateSound(SOUND_MENU, 0.04, 880.0, 880.0, false);
+
+	// Mono 16-bit output, buffer size sets latency
+	SDL_AudioSpec Want = {};
+	Want.freq = audioFrequency;
+	Want.format = AUDIO_S16SYS;
+	Want.channels = 1;
+	Want.samples = audioSamples;
+	Want.callback = MixAudio;
+
+	gAudioDevice = SDL_OpenAudioDevice(NULL, 0, &Want, NULL, 0);
+
+	// Failure
+	if (gAudioDevice == 0)
+	{
+		printf("Warning: Failed to open audio device. SDL_Error: %s\n", SDL_GetError());
+		return false;
+	}
+
+	// Start playback
+	SDL_PauseAudioDevice(gAudioDevice, 0);
+
+	return true;
+}
+
+// Generate sound effect as a decaying tone sweeping between two frequencies
+void GenerateSound(int sound, double length, double startFrequency, double endFrequency, bool square)
+{
+	int samples = int(length * audioFrequency);
+	double phase = 0;
+
+	gSounds[sound].resize(samples);
+
+	for (int i = 0; i < samples; ++i)
+	{
+		double t = double(i) / samples;
+		double wave = sin(phase * 2.0 * M_PI);
+
+		if (square) wave = wave < 0 ? -1.0 : 1.0;
+
+		gSounds[sound][i] = Sint16(wave * (1.0 - t) * 6000.0);
+
+		phase += (startFrequency + (endFrequency - startFrequency) * t) / audioFrequency;
+	}
+}
+
+// Queue sound effect for the mixer, drops it if queue is full
+void PlaySound(int sound)
+{
+	if (gAudioDevice == 0) return;
+
+	int head = SDL_AtomicGet(&soundQueueHead);
+	int next = (head + 1) % soundQueueSize;
+
+	if (next == SDL_AtomicGet(&soundQueueTail)) return;
+
+	soundQueue[head] = Uint8(sound);
+	SDL_AtomicSet(&soundQueueHead, next);
+}
+
+// Audio callback, mixes active voices without locks or allocations
+void MixAudio(void* data, Uint8* stream, int length)
+{
+	TRACE_ZONE("Mix audio");
+
+	Sint16* out = (Sint16*)stream;
+	int samples = length / 2;
+
+	// Start voices for queued sounds
+	int tail = SDL_AtomicGet(&soundQueueTail);
+
+	while (tail != SDL_AtomicGet(&soundQueueHead))
+	{
+		int sound = soundQueue[tail];
+
+		// Take a free voice, or the one furthest along
+		int voice = 0;
+		for (int i = 0; i < soundVoices; ++i)
+		{
+			if (voiceSound[i] == NULL) { voice = i; break; }
+			if (voicePosition[i] > voicePosition[voice]) voice = i;
+		}
+
+		voiceSound[voice] = gSounds[sound].data();
+		voiceLength[voice] = int(gSounds[sound].size());
+		voicePosition[voice] = 0;
+
+		tail = (tail + 1) % soundQueueSize;
+	}
+
+	SDL_AtomicSet(&soundQueueTail, tail);
+
+	// Silence
+	for (int i = 0; i < samples; ++i) out[i] = 0;
+
+	// Mix voices with saturation
+	for (int v = 0; v < soundVoices; ++v)
+	{
+		if (voiceSound[v] == NULL) continue;
+
+		const Sint16* source = voiceSound[v] + voicePosition[v];
+		int count = voiceLength[v] - voicePosition[v];
+		if (count > samples) count = samples;
+
+		for (int i = 0; i < count; ++i)
+		{
+			int mixed = out[i] + source[i];
+			out[i] = Sint16(mixed > 32767 ? 32767 : (mixed < -32768 ? -32768 : mixed));
+		}
+
+		voicePosition[v] += count;
+		if (voicePosition[v] >= voiceLength[v]) voiceSound[v] = NULL;
+	}
+}
+
+// Allocate block with size header and count it for the current phase
+void* TrackMalloc(size_t size)
+{
+	Uint8* block = (Uint8*)malloc(size + allocHeader);
+	if (block == NULL) return NULL;
+
+	*(size_t*)block = size;
+
+	SDL_AtomicAdd(&allocCount[allocPhase], 1);
+	SDL_AtomicAdd(&allocBytes[allocPhase], int(size));
+	SDL_AtomicAdd(&allocLive, int(size));
+
+	// Steady state gameplay should never allocate
+	if (allocSteady && allocAssert)
+	{
+		printf("Warning: Allocated %u bytes during gameplay.\n", unsigned(size));
+		SDL_assert(!"Allocation during steady state gameplay");
+	}
+
+	return block + allocHeader;
+}
+
+// Allocate zeroed block
+void* TrackCalloc(size_t count, size_t size)
+{
+	void* block = TrackMalloc(count * size);
+	if (block != NULL) memset(block, 0, count * size);
+
+	return block;
+}
+
+// Resize block, counted as a new allocation
+void* TrackRealloc(void* ptr, size_t size)
+{
+	if (ptr == NULL) return TrackMalloc(size);
+
+	Uint8* block = (Uint8*)ptr - allocHeader;
+	size_t oldSize = *(size_t*)block;
+
+	block = (Uint8*)realloc(block, size + allocHeader);
+	if (block == NULL) return NULL;
+
+	*(size_t*)block = size;
+
+	SDL_AtomicAdd(&allocCount[allocPhase], 1);
+	SDL_AtomicAdd(&allocBytes[allocPhase], int(size));
+	SDL_AtomicAdd(&allocLive, int(size) - int(oldSize));
+
+	if (allocSteady && allocAssert)
+	{
+		printf("Warning: Reallocated %u bytes during gameplay.\n", unsigned(size));
+		SDL_assert(!"Allocation during steady state gameplay");
+	}
+
+	return block + allocHeader;
+}
+
+// Free tracked block
+void TrackFree(void* ptr)
+{
+	if (ptr == NULL) return;
+
+	Uint8* block = (Uint8*)ptr - allocHeader;
+	SDL_AtomicAdd(&allocLive, -int(*(size_t*)block));
+
+	free(block);
+}
+
+// Store allocations of the finished frame and reset counters
+void EndAllocFrame()
+{
+	for (int i = 0; i < PHASE_SIZE; ++i)
+	{
+		allocFrameCount[i] = SDL_AtomicSet(&allocCount[i], 0);
+		allocFrameBytes[i] = SDL_AtomicSet(&allocBytes[i], 0);
+
+		allocTotalCount += allocFrameCount[i];
+		allocTotalBytes += allocFrameBytes[i];
+	}
+}
+
+// Print allocations of last frame per phase and totals
+void PrintAllocStats()
+{
+	const char* phaseNames[PHASE_SIZE] = { "other", "events", "states", "present" };
+
+	printf("Allocations last frame:\n");
+	for (int i = 0; i < PHASE_SIZE; ++i)
+	{
+		printf("  %-8s %6d allocs %10d bytes\n", phaseNames[i], allocFrameCount[i], allocFrameBytes[i]);
+	}
+
+	printf("Allocations total: %llu allocs, %llu bytes, %d bytes live\n",
+		(unsigned long long)allocTotalCount, (unsigned long long)allocTotalBytes, SDL_AtomicGet(&allocLive));
+}
+
+// Global new and delete go through the tracker
+void* operator new(size_t size)
+{
+	void* block = TrackMalloc(size);
+	if (block == NULL) throw std::bad_alloc();
+
+	return block;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+	TrackFree(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+	TrackFree(ptr);
+}
+
+void operator delete(void* ptr, size_t size) noexcept
+{
+	TrackFree(ptr);
+}
+
+void operator delete[](void* ptr, size_t size) noexcept
+{
+	TrackFree(ptr);
+}
+
+#ifdef SNEK_TRACE
+// Record zone into the calling thread's ring
+void TraceRecord(const char* name, Uint64 start, Uint64 end)
+{
+	// First zone on this thread, claim a ring
+	if (traceRing == NULL)
+	{
+		int thread = SDL_AtomicAdd(&traceRingCount, 1);
+		if (thread >= traceThreads) return;
+
+		traceRing = &traceRings[thread];
+	}
+
+	// Write event, then publish it
+	int written = SDL_AtomicGet(&traceRing->written);
+	TraceEvent& Event = traceRing->events[written % traceRingSize];
+	Event.name = name;
+	Event.start = start;
+	Event.end = end;
+	SDL_AtomicSet(&traceRing->written, written + 1);
+}
+
+// Write recorded zones of all threads as Chrome trace JSON
+void WriteTrace()
+{
+	FILE* file = fopen("trace.json", "w");
+
+	// Failure
+	if (file == NULL)
+	{
+		printf("Failed to open trace.json for writing.\n");
+		return;
+	}
+
+	const double microseconds = 1000000.0 / SDL_GetPerformanceFrequency();
+	bool first = true;
+
+	fprintf(file, "{\"traceEvents\":[\n");
+
+	int threads = SDL_AtomicGet(&traceRingCount);
+	if (threads > traceThreads) threads = traceThreads;
+
+	for (int t = 0; t < threads; ++t)
+	{
+		TraceRing* Ring = &traceRings[t];
+
+		// Oldest event still in the ring
+		int written = SDL_AtomicGet(&Ring->written);
+		int oldest = written > traceRingSize ? written - traceRingSize : 0;
+
+		for (int i = oldest; i < written; ++i)
+		{
+			const TraceEvent& Event = Ring->events[i % traceRingSize];
+
+			fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}",
+				first ? "" : ",\n", Event.name, Event.start * microseconds, (Event.end - Event.start) * microseconds, t);
+			first = false;
+		}
+	}
+
+	fprintf(file, "\n]}\n");
+	fclose(file);
+
+	printf("Trace written to trace.json.\n");
+}
+#endif
+
+// Fill sine lookup table in whole degrees
+void BuildSineTable()
+{
+	for (int i = 0; i < 360; ++i)
+	{
+		SineTable[i] = sin(i * CIRCLE);
+	}
+}
+
+// Evaluate all animation spins for the current time
+void UpdateAnimations()
+{
+	for (int i = 0; i < ANIM_SIZE; ++i)
+	{
+		// Angle from elapsed time, so speed does not depend on frame rate
+		int angle = int(Uint64(currentTime) * animSpeed[i] / stepFrame % 360);
+
+		animSin[i] = SineTable[angle];
+		animCos[i] = SineTable[(angle + 90) % 360];
+	}
+}
+
+// Open telemetry file and start writer thread
+bool StartTelemetry()
+{
+	// Games are appended across sessions
+	telemetryFile = fopen("telemetry.snt", "ab");
+
+	// Failure
+	if (telemetryFile == NULL)
+	{
+		printf("Warning: Failed to open telemetry.snt for writing.\n");
+		return false;
+	}
+
+	SDL_AtomicSet(&telemetryPending, 0);
+	SDL_AtomicSet(&telemetryQuit, 0);
+
+	telemetryReady = SDL_CreateSemaphore(0);
+	telemetryThread = SDL_CreateThread(TelemetryWriter, "TelemetryWriter", NULL);
+
+	return true;
+}
+
+// Start recording a new game
+void BeginGameTelemetry()
+{
+	TelemetryGame& Game = telemetryGames[telemetryCurrent];
+
+	Game.seed = gameSeed;
+	Game.gameSpeed = gameSpeed;
+	Game.width = Uint16(screenWidth);
+	Game.height = Uint16(screenHeight);
+	Game.endCause = END_NONE;
+	Game.eventCount = 0;
+}
+
+// Record event at current tick and head position
+void RecordTelemetry(int type)
+{
+	TelemetryGame& Game = telemetryGames[telemetryCurrent];
+	if (telemetryThread == NULL || Game.eventCount >= telemetryEvents) return;
+
+	int i = Game.eventCount++;
+	Game.eventType[i] = Uint8(type);
+	Game.eventTick[i] = rewindTick;
+	Game.eventX[i] = snakePosX;
+	Game.eventY[i] = snakePosY;
+	Game.eventLength[i] = snakeLength;
+}
+
+// Record how the game ended, first cause wins
+void EndGameTelemetry(int cause)
+{
+	TelemetryGame& Game = telemetryGames[telemetryCurrent];
+	if (Game.endCause != END_NONE) return;
+
+	Game.endCause = Uint8(cause);
+	Game.endX = snakePosX;
+	Game.endY = snakePosY;
+	Game.ticks = rewindTick;
+	Game.length = snakeLength;
+}
+
+// Drop events from given tick on, used when rewinding
+void TruncateTelemetry(unsigned int tick)
+{
+	TelemetryGame& Game = telemetryGames[telemetryCurrent];
+
+	while (Game.eventCount > 0 && Game.eventTick[Game.eventCount - 1] >= tick) --Game.eventCount;
+	Game.endCause = END_NONE;
+}
+
+// Hand finished game to writer and start recording into the other buffer
+void SubmitTelemetry()
+{
+	if (telemetryThread == NULL) return;
+
+	// Writer still busy with previous game
+	if (SDL_AtomicGet(&telemetryPending) != 0)
+	{
+		++telemetryDropped;
+		return;
+	}
+
+	SDL_AtomicSet(&telemetryPending, telemetryCurrent + 1);
+	SDL_SemPost(telemetryReady);
+
+	telemetryCurrent ^= 1;
+}
+
+// Append value as little endian varint
+Uint8* WriteVarint(Uint8* out, Uint32 value)
+{
+	while (value >= 0x80)
+	{
+		*out++ = Uint8(value | 0x80);
+		value >>= 7;
+	}
+
+	*out++ = Uint8(value);
+	return out;
+}
+
+// Writer thread, appends each game as a block of summary and event columns
+int TelemetryWriter(void* data)
+{
+	// Worst case block size
+	static Uint8 block[64 + telemetryEvents * 9];
+
+	while (true)
+	{
+		SDL_SemWait(telemetryReady);
+
+		int pending = SDL_AtomicGet(&telemetryPending);
+		if (pending == 0)
+		{
+			if (SDL_AtomicGet(&telemetryQuit)) break;
+			continue;
+		}
+
+		const TelemetryGame& Game = telemetryGames[pending - 1];
+		Uint8* out = block;
+
+		// Summary, fixed size so scans can read it and skip the columns
+		memcpy(out, &Game.seed, 8); out += 8;
+		memcpy(out, &Game.ticks, 4); out += 4;
+		memcpy(out, &Game.gameSpeed, 2); out += 2;
+		memcpy(out, &Game.width, 2); out += 2;
+		memcpy(out, &Game.height, 2); out += 2;
+		*out++ = Game.length;
+		*out++ = Game.endCause;
+		*out++ = Uint8(Game.endX);
+		*out++ = Uint8(Game.endY);
+		memcpy(out, &Game.eventCount, 4); out += 4;
+
+		// Columns, ticks delta coded as varints
+		for (int i = 0; i < Game.eventCount; ++i) *out++ = Game.eventType[i];
+
+		Uint32 lastTick = 0;
+		for (int i = 0; i < Game.eventCount; ++i)
+		{
+			out = WriteVarint(out, Game.eventTick[i] - lastTick);
+			lastTick = Game.eventTick[i];
+		}
+
+		for (int i = 0; i < Game.eventCount; ++i) *out++ = Uint8(Game.eventX[i]);
+		for (int i = 0; i < Game.eventCount; ++i) *out++ = Uint8(Game.eventY[i]);
+		for (int i = 0; i < Game.eventCount; ++i) *out++ = Game.eventLength[i];
+
+		// Release buffer back to game
+		SDL_AtomicSet(&telemetryPending, 0);
+
+		// Block header, magic and size of the rest
+		Uint32 header[2] = { 0x474B4E53, Uint32(out - block) };
+		fwrite(header, 4, 2, telemetryFile);
+		fwrite(block, 1, out - block, telemetryFile);
+		fflush(telemetryFile);
+	}
+
+	return 0;
+}
+
+// Submit game in progress, flush and stop writer
+void StopTelemetry()
 {
-	// Final texture
-	SDL_Texture* newTexture = NULL;
-
-	// Load image to surface at specified path
-	SDL_Surface* loadedSurface = IMG_Load(path.c_str());
-
-	// Color key surface
-	SDL_SetColorKey(loadedSurface, SDL_TRUE, SDL_MapRGB(loadedSurface->format, 0, 0, 255));
+	if (telemetryThread == NULL) return;
 
-	// Failure
-	if (loadedSurface == NULL)
+	if (stateInGame)
 	{
-		printf("Failed to load image %s. SDL_image Error: %s\n", path.c_str(), IMG_GetError());
-
-		return NULL;
+		EndGameTelemetry(END_QUIT);
+		SubmitTelemetry();
 	}
 
-	// Success
-	else
-	{
-		// Create texture from surface
-		newTexture = SDL_CreateTextureFromSurface(gRenderer, loadedSurface);
+	SDL_AtomicSet(&telemetryQuit, 1);
+	SDL_SemPost(telemetryReady);
+	SDL_WaitThread(telemetryThread, NULL);
+	telemetryThread = NULL;
 
-		// Failure
-		if (newTexture == NULL)
-		{
-			printf("Failed to create texture from %s. SDL Error: %s\n", path.c_str(), SDL_GetError());
-		}
+	SDL_DestroySemaphore(telemetryReady);
+	telemetryReady = NULL;
 
-		// Free surface
-		SDL_FreeSurface(loadedSurface);
-	}
+	fclose(telemetryFile);
+	telemetryFile = NULL;
 
-	return newTexture;
+	if (telemetryDropped > 0) printf("Warning: %u games dropped from telemetry.\n", telemetryDropped);
 }
 
-// Load and store texture into a vector container
-bool StoreTexture(std::string path)
+// Start capturing rendered frames to a Y4M video file
+bool StartCapture()
 {
-	// Load texture
-	SDL_Texture* gTexture = NULL;
-	gTexture = LoadTexture(path);
+	// Open file
+	captureFile = fopen("capture.y4m", "wb");
 
 	// Failure
-	if (gTexture == NULL)
+	if (captureFile == NULL)
 	{
-		printf("Failed to load texture image.\n");
+		printf("Failed to open capture.y4m for writing.\n");
 		return false;
 	}
 
-	// Add texture to storage
-	gTextures.push_back(gTexture);
+	// Preallocate frame pool at current resolution
+	captureWidth = screenWidth;
+	captureHeight = screenHeight;
+
+	for (int i = 0; i < captureBuffers; ++i)
+	{
+		captureFrames[i] = new Uint8[captureWidth * captureHeight * 3];
+	}
+
+	captureYUV = new Uint8[captureWidth * captureHeight * 3];
+
+	// Y4M header, 4:4:4 so no chroma is lost to subsampling
+	fprintf(captureFile, "YUV4MPEG2 W%d H%d F1000:%u Ip A1:1 C444\n", captureWidth, captureHeight, captureInterval);
+
+	// Reset ring and timeline
+	captureStart = currentTime;
+	captureLastSlot = -1;
+	captureWrite = 0;
+	captureRead = 0;
+	captureWritten = 0;
+	captureDropped = 0;
+	SDL_AtomicSet(&captureCount, 0);
+	SDL_AtomicSet(&captureQuit, 0);
+
+	// Start encoder thread
+	captureReady = SDL_CreateSemaphore(0);
+	captureThread = SDL_CreateThread(CaptureWriter, "CaptureWriter", NULL);
+
+	stateCapture = true;
+	printf("Capture started at %dx%d.\n", captureWidth, captureHeight);
 
 	return true;
 }
 
-// Generate random field of grass
-SDL_Surface* GenerateGrass()
+// Read back current frame into the next free buffer, call before SDL_RenderPresent
+void CaptureFrame()
 {
-	// Load source texture
-	SDL_Surface* gGrass = IMG_Load("grass.png");
+	// Encoder fell behind, drop frame rather than wait
+	if (SDL_AtomicGet(&captureCount) >= captureBuffers)
+	{
+		++captureDropped;
+		return;
+	}
 
-	// Destination surface
-	SDL_Surface* gGrassField = SDL_CreateRGBSurface(NULL, int(BASE_WIDTH), int(BASE_HEIGHT), 24, 0, 0, 0, 255);
+	// Slot of this frame on the video timeline
+	unsigned int slot = (currentTime - captureStart) / captureInterval;
 
-	// Failure
-	if (gGrass == NULL)
+	// Read back pixels
+	SDL_Rect RectCapture = { 0, 0, captureWidth, captureHeight };
+
+	if (SDL_RenderReadPixels(gRenderer, &RectCapture, SDL_PIXELFORMAT_RGB24, captureFrames[captureWrite], captureWidth * 3) != 0)
 	{
-		printf("Failed to load texture image.\n");
-		return NULL;
+		++captureDropped;
+		return;
 	}
 
-	// Success
-	else
+	// Hand buffer over to encoder
+	captureSlots[captureWrite] = slot;
+	captureWrite = (captureWrite + 1) % captureBuffers;
+	SDL_AtomicAdd(&captureCount, 1);
+	SDL_SemPost(captureReady);
+}
+
+// Encoder thread, converts queued frames to YUV and writes them out
+int CaptureWriter(void* data)
+{
+	const int pixels = captureWidth * captureHeight;
+
+	while (true)
 	{
-		// Set random seed
-		srand(currentTime);
-		
-		// Source of grass patch
-		SDL_Rect RectGrassSource;
-		RectGrassSource.x = 0;
-		RectGrassSource.y = 0;
-		RectGrassSource.w = 32;
-		RectGrassSource.h = 32;
+		SDL_SemWait(captureReady);
 
-		// Destination of grass patch
-		SDL_Rect RectGrassDest;
-		RectGrassDest.x = 0;
-		RectGrassDest.y = 0;
-		RectGrassDest.w = 32;
-		RectGrassDest.h = 32;
+		// Finished when asked to quit and queue is drained
+		if (SDL_AtomicGet(&captureCount) == 0)
+		{
+			if (SDL_AtomicGet(&captureQuit)) break;
+			continue;
+		}
 
-		// Place 32x32 patches of grass on destination surface
-		for (int y = 0; y < 8; ++y)
+		TRACE_ZONE("Encode frame");
+
+		int slot = int(captureSlots[captureRead]);
+
+		// Frame shares a slot with the previous one, skip it
+		if (slot <= captureLastSlot)
 		{
-			RectGrassDest.y = y * 32;
+			captureRead = (captureRead + 1) % captureBuffers;
+			SDL_AtomicAdd(&captureCount, -1);
+			continue;
+		}
 
-			for (int x = 0; x < 10; ++x)
+		// Hold previous frame over slots of dropped or late frames
+		if (captureLastSlot >= 0)
+		{
+			for (int i = captureLastSlot + 1; i < slot; ++i)
 			{
-				RectGrassSource.x = rand() % 8 * 32;
-				RectGrassDest.x = x * 32;
-				SDL_BlitSurface(gGrass, &RectGrassSource, gGrassField, &RectGrassDest);
+				fputs("FRAME\n", captureFile);
+				fwrite(captureYUV, 1, pixels * 3, captureFile);
+				++captureWritten;
 			}
 		}
 
-		return gGrassField;
+		captureLastSlot = slot;
+
+		// Convert RGB to BT.601 YUV planes
+		Uint8* rgb = captureFrames[captureRead];
+
+		for (int i = 0; i < pixels; ++i)
+		{
+			int r = rgb[i * 3], g = rgb[i * 3 + 1], b = rgb[i * 3 + 2];
+
+			captureYUV[i] = Uint8(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+			captureYUV[pixels + i] = Uint8(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+			captureYUV[pixels * 2 + i] = Uint8(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+		}
+
+		// Release buffer back to game loop
+		captureRead = (captureRead + 1) % captureBuffers;
+		SDL_AtomicAdd(&captureCount, -1);
+
+		// Write frame
+		fputs("FRAME\n", captureFile);
+		fwrite(captureYUV, 1, pixels * 3, captureFile);
+		++captureWritten;
+	}
+
+	return 0;
+}
+
+// Stop capturing, flush queued frames and report
+void StopCapture()
+{
+	if (!stateCapture) return;
+
+	// Let encoder drain and finish
+	SDL_AtomicSet(&captureQuit, 1);
+	SDL_SemPost(captureReady);
+	SDL_WaitThread(captureThread, NULL);
+	captureThread = NULL;
+
+	SDL_DestroySemaphore(captureReady);
+	captureReady = NULL;
+
+	fclose(captureFile);
+	captureFile = NULL;
+
+	// Free frame pool
+	for (int i = 0; i < captureBuffers; ++i)
+	{
+		delete[] captureFrames[i];
+		captureFrames[i] = NULL;
 	}
+
+	delete[] captureYUV;
+	captureYUV = NULL;
+
+	stateCapture = false;
+	printf("Capture stopped. %u frames written, %u dropped.\n", captureWritten, captureDropped);
 }
 
 // Close function
 void Close()
 {
-	// Destroy textures
-	for (SDL_Texture* i : gTextures)
+	// Finish capture, telemetry and export
+	StopCapture();
+	StopTelemetry();
+	CloseShard();
+
+	// Stop bot
+	StopBot();
+
+#ifdef SNEK_TRACE
+	// Keep trace of the session
+	WriteTrace();
+#endif
+
+	// Close audio
+	if (gAudioDevice != 0)
 	{
-		SDL_DestroyTexture(i);
-		i = NULL;
+		SDL_CloseAudioDevice(gAudioDevice);
+		gAudioDevice = 0;
+	}
+
+	// Report textures still referenced, then destroy everything
+	for (TextureResource& Resource : gTextures)
+	{
+		if (Resource.references > 0)
+			printf("Warning: Texture %s leaked with %d references.\n", Resource.name.c_str(), Resource.references);
+
+		if (Resource.texture != NULL) SDL_DestroyTexture(Resource.texture);
+		if (Resource.surface != NULL) SDL_FreeSurface(Resource.surface);
 	}
 
-	// Clear texture vector
+	// Clear texture table
 	gTextures.clear();
 
 	// Destroy window
@@ -452,9 +3218,81 @@ void Close()
 // Main
 int main(int argc, char* args[])
 {
+	// Track SDL allocations, must happen before any other SDL call
+	SDL_SetMemoryFunctions(TrackMalloc, TrackCalloc, TrackRealloc, TrackFree);
+
+	// No portals until a level is loaded
+	for (int i = 0; i < BOARD_HEIGHT * BOARD_WIDTH; ++i) levelPortal[i] = -1;
+
+	// Command line options
+	for (int i = 1; i < argc; ++i)
+	{
+		// Fixed seed for every game
+		if (strcmp(args[i], "-seed") == 0 && i + 1 < argc)
+			seedOption = strtoull(args[++i], NULL, 10);
+
+		// Level map
+		else if (strcmp(args[i], "-level") == 0 && i + 1 < argc)
+			LoadLevel(args[++i]);
+
+		// Bot plugin driving the snake
+		else if (strcmp(args[i], "-bot") == 0 && i + 1 < argc)
+			LoadBot(args[++i]);
+
+		// Milliseconds a bot may think per move
+		else if (strcmp(args[i], "-botdeadline") == 0 && i + 1 < argc)
+			botDeadline = Uint32(atoi(args[++i]));
+
+		// Serve games to a trainer process through shared memory and quit
+		else if (strcmp(args[i], "-envserver") == 0 && i + 1 < argc)
+		{
+			stateEnvServer = true;
+			envName = args[++i];
+		}
+
+		// Benchmark free space connectivity and quit
+		else if (strcmp(args[i], "-benchregions") == 0)
+			stateBenchRegions = true;
+
+		// Audio buffer in samples, sets output latency
+		else if (strcmp(args[i], "-audiosamples") == 0 && i + 1 < argc)
+		{
+			int samples = atoi(args[++i]);
+
+			if (samples >= 64 && samples <= 8192 && (samples & (samples - 1)) == 0) audioSamples = Uint16(samples);
+			else printf("Warning: -audiosamples must be a power of two from 64 to 8192, keeping %d.\n", audioSamples);
+		}
+
+		// Append game records to telemetry.snt
+		else if (strcmp(args[i], "-telemetry") == 0)
+			stateTelemetry = true;
+
+		// Export transitions of played games
+		else if (strcmp(args[i], "-export") == 0)
+		{
+			stateExport = true;
+			exportSession = unsigned(time(NULL));
+		}
+	}
+
+	if (stateEnvServer)
+	{
+		RunEnvServer();
+		return 0;
+	}
+
+	if (stateBenchRegions)
+	{
+		BenchRegions(1000000);
+		return 0;
+	}
+
 	// Set resolution
 	SetResolution(resolutionSelect);
 
+	// Precompute trigonometry
+	BuildSineTable();
+
 	// Initialize SDL and create window
 
 	// Failure
@@ -479,56 +3317,25 @@ int main(int argc, char* args[])
 		SDL_Event Event;
 
 		// Load textures
-		StoreTexture("splash.png");
-		SDL_Texture* gSplash = gTextures.back();
+		SDL_Texture* gSplash = GetTexture(StoreTexture("splash.png"));
 		SDL_Texture* gBackground = gSplash;
-
-		StoreTexture("title.png");
-		SDL_Texture* gTitle = gTextures.back();
-
-		StoreTexture("menu.png");
-		SDL_Texture* gMenu = gTextures.back();
-
-		StoreTexture("options.png");
-		SDL_Texture* gOptions = gTextures.back();
-
-		StoreTexture("resolution.png");
-		SDL_Texture* gResolution = gTextures.back();
-
-		StoreTexture("arrow.png");
-		SDL_Texture* gArrow = gTextures.back();
-
-		StoreTexture("arrow_up.png");
-		SDL_Texture* gArrowUp = gTextures.back();
-
-		StoreTexture("arrow_dn.png");
-		SDL_Texture* gArrowDown = gTextures.back();
-
-		StoreTexture("hammer.png");
-		SDL_Texture* gHammer = gTextures.back();
-
-		StoreTexture("tickbox.png");
-		SDL_Texture* gTickbox = gTextures.back();
-
-		StoreTexture("tick.png");
-		SDL_Texture* gTick = gTextures.back();
-
-		StoreTexture("meter.png");
-		SDL_Texture* gMeter = gTextures.back();
-
-		StoreTexture("snake.png");
-		SDL_Texture* gSnake = gTextures.back();
-
-		StoreTexture("applered.png");
-		SDL_Texture* gAppleRed = gTextures.back();
-
-		StoreTexture("applegreen.png");
-		SDL_Texture* gAppleGreen = gTextures.back();
-
-		StoreTexture("gameover.png");
-		SDL_Texture* gGameOver = gTextures.back();
-
-		SDL_Texture* gGrassTexture = NULL;
+		SDL_Texture* gTitle = GetTexture(StoreTexture("title.png"));
+		SDL_Texture* gMenu = GetTexture(StoreTexture("menu.png"));
+		SDL_Texture* gOptions = GetTexture(StoreTexture("options.png"));
+		SDL_Texture* gResolution = GetTexture(StoreTexture("resolution.png"));
+		SDL_Texture* gArrow = GetTexture(StoreTexture("arrow.png"));
+		SDL_Texture* gArrowUp = GetTexture(StoreTexture("arrow_up.png"));
+		SDL_Texture* gArrowDown = GetTexture(StoreTexture("arrow_dn.png"));
+		SDL_Texture* gHammer = GetTexture(StoreTexture("hammer.png"));
+		SDL_Texture* gTickbox = GetTexture(StoreTexture("tickbox.png"));
+		SDL_Texture* gTick = GetTexture(StoreTexture("tick.png"));
+		SDL_Texture* gMeter = GetTexture(StoreTexture("meter.png"));
+		SDL_Texture* gSnake = GetTexture(StoreTexture("snake.png"));
+		SDL_Texture* gAppleRed = GetTexture(StoreTexture("applered.png"));
+		SDL_Texture* gAppleGreen = GetTexture(StoreTexture("applegreen.png"));
+		SDL_Texture* gGameOver = GetTexture(StoreTexture("gameover.png"));
+
+		TextureHandle hGrass = -1;
 
 		// Main loop
 		while (!quit)
@@ -537,7 +3344,12 @@ int main(int argc, char* args[])
 			currentTime = SDL_GetTicks();
 			if (currentTime > lastTime + step)
 			{
+				// Advance animations
+				UpdateAnimations();
+
 				// Process event queue
+				allocPhase = PHASE_EVENTS;
+				TRACE_BEGIN(traceEvents);
 				while (SDL_PollEvent(&Event) != 0)
 				{
 					// Quit
@@ -579,6 +3391,10 @@ int main(int argc, char* args[])
 							userEsc = false;
 							break;
 
+						case SDLK_BACKSPACE:
+							userBack = false;
+							break;
+
 						default:
 							break;
 						}
@@ -628,15 +3444,47 @@ int main(int argc, char* args[])
 							userPressedEsc = true;
 							break;
 
+						case SDLK_BACKSPACE:
+							userBack = true;
+							break;
+
+						case SDLK_F12:
+							if (stateCapture) StopCapture();
+							else StartCapture();
+							break;
+
+						case SDLK_F9:
+							stateInterpolate = !stateInterpolate;
+							break;
+
+						case SDLK_F11:
+							PrintAllocStats();
+							PrintTextureStats();
+							PrintBotStats();
+							break;
+
+#ifdef SNEK_TRACE
+						case SDLK_F10:
+							WriteTrace();
+							break;
+#endif
+
 						default:
 							break;
 						}
 					}
 				}
 
+				TRACE_END(traceEvents, "Events");
+
+				// Update states
+				allocPhase = PHASE_STATES;
+
 				// Title state
 				if (stateTitleScreen == true)
 				{
+					TRACE_ZONE("Title");
+
 					// Set speed
 					step = stepNormal;
 
@@ -650,11 +3498,9 @@ int main(int argc, char* args[])
 
 					// Bouncy title logo
 					const double TITLE_R = 10.0;
-					static Uint16 titleSpin = 0;
 
-					RectTitle.x = (screenWidth * 0.1) + int(sin(titleSpin * CIRCLE) * (TITLE_R / BASE_WIDTH) * screenWidth / 2);
-					RectTitle.y = (screenHeight * 0.1) + int(cos(titleSpin * CIRCLE) * (TITLE_R / BASE_HEIGHT) * screenHeight);
-					titleSpin += 2; if (titleSpin >= 360) titleSpin = 0;
+					RectTitle.x = (screenWidth * 0.1) + int(animSin[ANIM_TITLE] * (TITLE_R / BASE_WIDTH) * screenWidth / 2);
+					RectTitle.y = (screenHeight * 0.1) + int(animCos[ANIM_TITLE] * (TITLE_R / BASE_HEIGHT) * screenHeight);
 					
 					// Update graphics
 
@@ -671,6 +3517,8 @@ int main(int argc, char* args[])
 				// Menu state
 				if (stateMenu)
 				{
+					TRACE_ZONE("Menu");
+
 					// Escape from menu?
 					if (userEsc)
 					{
@@ -688,6 +3536,7 @@ int main(int argc, char* args[])
 							if (userDown && menuSelect < MENU_SIZE - 1)
 							{
 								menuSelect += 1;
+								PlaySound(SOUND_MENU);
 								userDown = false;
 							}
 
@@ -695,12 +3544,15 @@ int main(int argc, char* args[])
 							else if (userUp && menuSelect > 0)
 							{
 								menuSelect -= 1;
+								PlaySound(SOUND_MENU);
 								userUp = false;
 							}
 
 							// Press enter in menu
 							else if (userEnter)
 							{
+								PlaySound(SOUND_MENU);
+
 								switch (menuSelect)
 								{
 								case START:
@@ -708,7 +3560,6 @@ int main(int argc, char* args[])
 									stateMenu = false;
 									stateInGame = true;
 									stateGameStart = true;
-									step = stepLogic;
 									break;
 
 								case SCORES:
@@ -737,11 +3588,9 @@ int main(int argc, char* args[])
 
 						// Spinny menu
 						const double MENU_R = 5.0;
-						static Uint16 menuSpin = 0;
 
-						RectMenu.x = (screenWidth * 0.3) - int(sin(menuSpin * CIRCLE) * (MENU_R / BASE_WIDTH) * screenWidth);
-						RectMenu.y = (screenHeight * 0.4) + int(cos(menuSpin * CIRCLE) * (MENU_R / BASE_HEIGHT) * screenHeight);
-						menuSpin += 3; if (menuSpin >= 360) menuSpin = 0;
+						RectMenu.x = (screenWidth * 0.3) - int(animSin[ANIM_MENU] * (MENU_R / BASE_WIDTH) * screenWidth);
+						RectMenu.y = (screenHeight * 0.4) + int(animCos[ANIM_MENU] * (MENU_R / BASE_HEIGHT) * screenHeight);
 						
 						// Render menu
 						SDL_RenderCopy(gRenderer, gMenu, NULL, &RectMenu);
@@ -751,10 +3600,8 @@ int main(int argc, char* args[])
 
 						// Bouncy arrow X position
 						const double ARROW_R = 5.0; 
-						static Uint16 arrowSpin = 0;
 
-						RectArrow.x = (screenWidth * 0.25) + int(sin(arrowSpin * CIRCLE) * (ARROW_R / BASE_WIDTH) * screenWidth);
-						arrowSpin += 10; if (arrowSpin >= 360) arrowSpin = 0;
+						RectArrow.x = (screenWidth * 0.25) + int(animSin[ANIM_ARROW] * (ARROW_R / BASE_WIDTH) * screenWidth);
 						
 						// Render arrow
 						SDL_RenderCopy(gRenderer, gArrow, NULL, &RectArrow);
@@ -764,6 +3611,8 @@ int main(int argc, char* args[])
 				// Options state
 				if (stateOptions)
 				{
+					TRACE_ZONE("Options");
+
 					// Escape from options?
 					if (userEsc && !stateResolution)
 					{
@@ -790,6 +3639,7 @@ int main(int argc, char* args[])
 							if (userDown && optionsSelect < OPTIONS_SIZE - 1)
 							{
 								optionsSelect += 1;
+								PlaySound(SOUND_MENU);
 								userDown = false;
 							}
 
@@ -797,12 +3647,15 @@ int main(int argc, char* args[])
 							else if (userUp && optionsSelect > 0)
 							{
 								optionsSelect -= 1;
+								PlaySound(SOUND_MENU);
 								userUp = false;
 							}
 
 							// Press enter in options
 							else if (userEnter)
 							{
+								PlaySound(SOUND_MENU);
+
 								switch (optionsSelect)
 								{
 								case RESOLUTION:
@@ -818,6 +3671,9 @@ int main(int argc, char* args[])
 									break;
 
 								case APPLY_CHANGES:
+									// Capture buffers are sized for the old resolution
+									StopCapture();
+
 									// Set resolution
 									resolutionSelect = resolutionSelectTemp;
 									SetResolution(resolutionSelect);
@@ -872,6 +3728,7 @@ int main(int argc, char* args[])
 							if (userDown && resolutionSelectTemp < RES_SIZE - 1)
 							{
 								resolutionSelectTemp += 1;
+								PlaySound(SOUND_MENU);
 								userDown = false;
 							}
 
@@ -879,6 +3736,7 @@ int main(int argc, char* args[])
 							else if (userUp && resolutionSelectTemp > 0)
 							{
 								resolutionSelectTemp -= 1;
+								PlaySound(SOUND_MENU);
 								userUp = false;
 							}
 
@@ -901,11 +3759,9 @@ int main(int argc, char* args[])
 
 						// Spinny options
 						const double OPTIONS_R = 5.0;
-						static Uint16 optionsSpin = 0;
 
-						RectOptions.x = (screenWidth * 0.1) - int(sin(optionsSpin * CIRCLE) * (OPTIONS_R / BASE_WIDTH) * screenWidth);
-						RectOptions.y = (screenHeight * 0.1) + int(cos(optionsSpin * CIRCLE) * (OPTIONS_R / BASE_HEIGHT) * screenHeight);
-						optionsSpin += 3; if (optionsSpin >= 360) optionsSpin = 0;
+						RectOptions.x = (screenWidth * 0.1) - int(animSin[ANIM_OPTIONS] * (OPTIONS_R / BASE_WIDTH) * screenWidth);
+						RectOptions.y = (screenHeight * 0.1) + int(animCos[ANIM_OPTIONS] * (OPTIONS_R / BASE_HEIGHT) * screenHeight);
 
 						// Render options
 						SDL_RenderCopy(gRenderer, gOptions, NULL, &RectOptions);
@@ -951,10 +3807,8 @@ int main(int argc, char* args[])
 
 							// Bouncy hammer X position
 							const double HAMMER_R = 5.0;
-							static Uint16 hammerSpin = 0;
 
-							RectHammer.x = (screenWidth * 0.08) + int(sin(hammerSpin * CIRCLE) * (HAMMER_R / BASE_WIDTH) * screenWidth);
-							hammerSpin += 10; if (hammerSpin >= 360) hammerSpin = 0;
+							RectHammer.x = (screenWidth * 0.08) + int(animSin[ANIM_HAMMER] * (HAMMER_R / BASE_WIDTH) * screenWidth);
 
 							// Render hammer
 							SDL_RenderCopy(gRenderer, gHammer, NULL, &RectHammer);
@@ -965,24 +3819,21 @@ int main(int argc, char* args[])
 						{
 							// Bouncy mini arrow Y positions
 							const double MINIARROW_R = 4.0;
-							static Uint16 miniArrowSpin = 0;
 
 							// Set mini arrow positions and render
 							RectMiniArrow.x = RectOptions.x + (0.54 * screenWidth);
 
 							if (resolutionSelectTemp > 0)
 							{
-								RectMiniArrow.y = RectOptions.y + (0.05 * screenHeight) + int(sin(miniArrowSpin * CIRCLE) * (MINIARROW_R / BASE_WIDTH) * screenHeight);
+								RectMiniArrow.y = RectOptions.y + (0.05 * screenHeight) + int(animSin[ANIM_MINIARROW] * (MINIARROW_R / BASE_WIDTH) * screenHeight);
 								SDL_RenderCopy(gRenderer, gArrowUp, NULL, &RectMiniArrow);
 							}
 
 							if (resolutionSelectTemp < RES_SIZE - 1)
 							{
-								RectMiniArrow.y = RectOptions.y + (0.21 * screenHeight) - int(sin(miniArrowSpin * CIRCLE) * (MINIARROW_R / BASE_WIDTH) * screenHeight);
+								RectMiniArrow.y = RectOptions.y + (0.21 * screenHeight) - int(animSin[ANIM_MINIARROW] * (MINIARROW_R / BASE_WIDTH) * screenHeight);
 								SDL_RenderCopy(gRenderer, gArrowDown, NULL, &RectMiniArrow);
 							}
-
-							miniArrowSpin += 20; if (miniArrowSpin >= 360) miniArrowSpin = 0;							
 						}
 					}
 				}
@@ -990,15 +3841,10 @@ int main(int argc, char* args[])
 				// Game state
 				if (stateInGame)
 				{
-					// Game logic data
-					static Uint8 Snake[15][20][4];
-					const Uint8 snakeLengthStart = 1, snakeStartPosX = 10, snakeStartPosY = 7;
-					static Uint8 snakeLength, snakeDirection, snakeDirectionLast;
-					static char snakePosX, snakePosY, applePosX, applePosY;
-					bool appleEaten = false;
+					TRACE_ZONE("Game");
 
 					// Game start condition
-					if (stateGameStart)
+					if (stateGameStart && BotIdle())
 					{
 						// Reset inputs
 						userPressedKey = false;
@@ -1013,34 +3859,17 @@ int main(int argc, char* args[])
 						// Game is obviously not over
 						stateGameOver = false;
 
-						// Generate grass
-						gGrassTexture = SDL_CreateTextureFromSurface(gRenderer, GenerateGrass());
-
-						// Clear snake table
-						for (int y = 0; y < 15; ++y)
-						{
-							for (int x = 0; x < 20; ++x)
-							{
-								Snake[y][x][0] = 0;
-								Snake[y][x][1] = 0;
-								Snake[y][x][2] = 0;
-								Snake[y][x][3] = 0;
-							}
-						}
+						// Seed random streams, printed so the game can be reproduced with -seed
+						SeedGame(seedOption != 0 ? seedOption : SDL_GetPerformanceCounter());
+						printf("Game seed: %llu\n", (unsigned long long)gameSeed);
+						BeginGameTelemetry();
 
-						// Initialise variables
-						snakeLength = snakeLengthStart;
-						snakeDirection = RIGHT;
-						snakeDirectionLast = RIGHT;
-						snakePosX = snakeStartPosX;
-						snakePosY = snakeStartPosY;
-						appleEaten = false;
+						// Generate grass
+						ReleaseTexture(hGrass);
+						hGrass = StoreSurface(GenerateGrass(), "grass", RESOURCE_GRASS);
 
-						// Place apple at start
-						do {
-							applePosX = rand() % 20;
-							applePosY = rand() % 15;
-						} while (applePosX == snakeStartPosX && applePosY == snakeStartPosY);
+						// Fresh board
+						ResetGame();
 
 						// Finished
 						stateGameStart = false;
@@ -1049,115 +3878,50 @@ int main(int argc, char* args[])
 					// Escape?
 					if (userEsc || userPressedEsc)
 					{
+						EndGameTelemetry(END_ESCAPE);
+						SubmitTelemetry();
+
 						stateTitleScreen = true;
 						stateInGame = false;
 						stateGameRunning = false;
 						userPressedEsc = false;
 					}
 
-					// Update game logic
-					else if (stateGameRunning)
+					// Rewind one tick per frame while held, game pauses until next key press
+					else if (userBack)
 					{
-						// Set 'timer' for snake part (element 0)
-						if (Snake[snakePosY][snakePosX][0] == 0)
-							Snake[snakePosY][snakePosX][0] = snakeLength;
-
-						// Jump over snake condition goes here
-						// else if (snake is jumping) --> set element 3 to appropriate tile // Not implemented yet
-
-						// If square was not empty, snake crawled into itself
-						else
+						if (BotIdle() && rewindTick > OldestRewindTick() && SeekGame(rewindTick - 1))
 						{
-							stateGameOver = true;
+							stateGameOver = false;
 							stateGameRunning = false;
-								
-							positionGameOver = -32;
-							velocityGameOver = 0;
-
-							step = stepNormal;
-							loseTime = currentTime;
-						}
-
-						// Set correct snake sprite (element 1)
-						if (snakeDirection == snakeDirectionLast)
-						{
-							if (snakeDirection < 2) Snake[snakePosY][snakePosX][1] = 0;
-							else Snake[snakePosY][snakePosX][1] = 1;
 						}
-						else if (snakeDirectionLast == UP) Snake[snakePosY][snakePosX][1] = 2 + snakeDirection;
-						else if (snakeDirectionLast == DOWN) Snake[snakePosY][snakePosX][1] = 4 + snakeDirection;
-						else if (snakeDirectionLast == LEFT) Snake[snakePosY][snakePosX][1] = 7 - (snakeDirection * 2);
-						else Snake[snakePosY][snakePosX][1] = 6 - (snakeDirection * 2);
-
-						// Set direction (element 2)
-						Snake[snakePosY][snakePosX][2] = snakeDirection;
 
-						// Remember direction faced at start
-						snakeDirectionLast = snakeDirection;
+						userPressedKey = false;
+					}
 
-						// Control and movement
-						switch (snakeDirection)
+					// Update game logic at a fixed rate, independent of frame rate
+					else if (stateGameRunning)
+					{
+						// Catch up on ticks missed during slow frames
+						for (int i = 0; i < logicCatchUp && stateGameRunning && currentTime >= lastLogicTime + stepLogic; ++i)
 						{
-						case UP:
-							snakePosY--;
-							if (userLeft || userPressedLeft) snakeDirection = LEFT;
-							else if (userRight || userPressedRight) snakeDirection = RIGHT;
-							break;
-
-						case DOWN:
-							snakePosY++;
-							if (userLeft || userPressedLeft) snakeDirection = LEFT;
-							else if (userRight || userPressedRight) snakeDirection = RIGHT;
-							break;
-
-						case LEFT:
-							snakePosX--;
-							if (userUp || userPressedUp) snakeDirection = UP;
-							else if (userDown || userPressedDown) snakeDirection = DOWN;
-							break;
-
-						case RIGHT:
-							snakePosX++;
-							if (userUp || userPressedUp) snakeDirection = UP;
-							else if (userDown || userPressedDown) snakeDirection = DOWN;
-							break;
-						
-						default:
-							break;
-						}
-
-						// Warp around
-
-						// X wrap
-						if (snakePosX < 0) snakePosX = 19;
-						else if (snakePosX >= 20) snakePosX = 0;
+							// A late bot still reads the board, hold the game until it answers
+							if (!BotIdle())
+							{
+								++botHeld;
+								break;
+							}
 
-						// Y wrap
-						if (snakePosY < 0) snakePosY = 14;
-						else if (snakePosY >= 15) snakePosY = 0;
+							// Game ticks are expected not to allocate
+							allocSteady = true;
+							UpdateGame(false);
+							allocSteady = false;
 
-						// Collect apple
-						if (applePosX == snakePosX && applePosY == snakePosY)
-						{
-							appleEaten = true;
-							++snakeLength;
-
-							// Find new place for apple
-							do {
-								applePosX = rand() % 20;
-								applePosY = rand() % 15;
-							} while (!Snake[applePosY][applePosX][0] == 0);
+							lastLogicTime += stepLogic;
 						}
 
-						// Reset inputs
-						userPressedKey = false;
-						userPressedUp = false;
-						userPressedDown = false;
-						userPressedLeft = false;
-						userPressedRight = false;
-						userPressedEnter = false;
-						userPressedSpace = false;
-						userPressedEsc = false;
+						// Too far behind, drop the missed ticks
+						if (currentTime >= lastLogicTime + stepLogic) lastLogicTime = currentTime;
 					}
 
 					// If game is not running, run when key pressed
@@ -1165,19 +3929,62 @@ int main(int argc, char* args[])
 					{
 						stateGameRunning = true;
 						userPressedKey = false;
+						lastLogicTime = currentTime;
 					}
 
 					// Render game graphics
 
 					// Render grass
-					SDL_RenderCopy(gRenderer, gGrassTexture, NULL, NULL);
+					SDL_RenderCopy(gRenderer, GetTexture(hGrass), NULL, NULL);
+
+					// Render level walls and portals
+					if (stateLevel)
+					{
+						for (int y = 0; y < BOARD_HEIGHT; ++y)
+						{
+							for (int x = 0; x < BOARD_WIDTH; ++x)
+							{
+								if (Level[y][x] == TILE_EMPTY) continue;
+
+								if (Level[y][x] == TILE_WALL) SDL_SetRenderDrawColor(gRenderer, 64, 48, 32, 255);
+								else SDL_SetRenderDrawColor(gRenderer, 160, 64, 224, 255);
+
+								RectSnakeDest.x = int(x * (16.0 / BASE_WIDTH) * screenWidth);
+								RectSnakeDest.y = int(y * (16.0 / BASE_HEIGHT) * screenHeight);
+								SDL_RenderFillRect(gRenderer, &RectSnakeDest);
+							}
+						}
+
+						SDL_SetRenderDrawColor(gRenderer, 0, 0, 0, 255);
+					}
+
+					// Fraction of current logic step elapsed, for sliding head and tail
+					bool interpolating = stateInterpolate && stateGameRunning;
+					double stepFraction = 0;
+					if (interpolating)
+					{
+						stepFraction = double(currentTime - lastLogicTime) / stepLogic;
+						if (stepFraction > 1.0) stepFraction = 1.0;
+					}
+
+					// Tail slides unless it stays put for an eaten apple
+					bool tailSlides = interpolating && !appleEaten;
+					int tailX = -1, tailY = -1;
 
 					// Render snake body
-					for (int y = 0; y < 15; ++y)
+					TRACE_BEGIN(traceSnake);
+					for (int y = 0; y < BOARD_HEIGHT; ++y)
 					{
-						for (int x = 0; x < 20; ++x)
+						for (int x = 0; x < BOARD_WIDTH; ++x)
 						{
-							if (Snake[y][x][0] > 0)
+							// Sliding tail is drawn over the body afterwards
+							if (Snake[y][x][0] == 1 && tailSlides)
+							{
+								tailX = x;
+								tailY = y;
+							}
+
+							else if (Snake[y][x][0] > 0)
 							{
 								// Set correct tile position (x from element 1)
 								if (Snake[y][x][0] > 1)
@@ -1193,12 +4000,6 @@ int main(int argc, char* args[])
 									RectSnakeSource.y = 0;
 								}
 
-								// Decrement 'timer' for snake part (element 0) unless apple eaten
-								if (!appleEaten && !stateGameOver)
-								{
-									--Snake[y][x][0];
-								}
-
 								// Scale destination tile for screen resolution
 								RectSnakeDest.x = int(x * (16.0 / BASE_WIDTH) * screenWidth);
 								RectSnakeDest.y = int(y * (16.0 / BASE_HEIGHT) * screenHeight);
@@ -1209,12 +4010,21 @@ int main(int argc, char* args[])
 						}
 					}
 
-					// Render snake head
+					// Render tail sliding towards next part (direction from element 2)
+					if (tailX >= 0)
+					{
+						int tailDirection = Snake[tailY][tailX][2];
+						RectSnakeSource.x = 64 + (16 * tailDirection);
+						RectSnakeSource.y = 0;
+						RenderTile(gSnake, tailX + directionX[tailDirection] * stepFraction, tailY + directionY[tailDirection] * stepFraction);
+					}
+					TRACE_END(traceSnake, "Render snake");
+
+					// Render snake head, sliding in from the previous cell
+					double headLag = interpolating ? 1.0 - stepFraction : 0;
 					RectSnakeSource.x = snakeDirectionLast * 16;
 					RectSnakeSource.y = 0;
-					RectSnakeDest.x = int(snakePosX * (16.0 / BASE_WIDTH) * screenWidth);
-					RectSnakeDest.y = int(snakePosY * (16.0 / BASE_HEIGHT) * screenHeight);
-					SDL_RenderCopy(gRenderer, gSnake, &RectSnakeSource, &RectSnakeDest);
+					RenderTile(gSnake, snakePosX - directionX[snakeDirectionLast] * headLag, snakePosY - directionY[snakeDirectionLast] * headLag);
 
 					// Render apple
 					RectApple.x = int(applePosX * (16.0 / BASE_WIDTH) * screenWidth);
@@ -1224,13 +4034,19 @@ int main(int argc, char* args[])
 					// Game Over condition and render Game Over text
 					if (stateGameOver)
 					{
-						++velocityGameOver;
-						positionGameOver += velocityGameOver;
-
-						if (positionGameOver / 10 > (BASE_HEIGHT - 32) / 2)
+						// Integrate drop in fixed steps of elapsed time, one per normal frame
+						while (lastGameOverTime + stepFrame <= currentTime)
 						{
-							positionGameOver = (BASE_HEIGHT - 32) * 5;
-							velocityGameOver *= -0.5;
+							++velocityGameOver;
+							positionGameOver += velocityGameOver;
+
+							if (positionGameOver / 10 > (BASE_HEIGHT - 32) / 2)
+							{
+								positionGameOver = (BASE_HEIGHT - 32) * 5;
+								velocityGameOver *= -0.5;
+							}
+
+							lastGameOverTime += stepFrame;
 						}
 
 						RectGameOver.y = (positionGameOver / 10) * (screenHeight / BASE_HEIGHT);
@@ -1239,6 +4055,8 @@ int main(int argc, char* args[])
 						// Go back to title screen after 4 seconds
 						if (loseTime + 4000 < currentTime)
 						{
+							SubmitTelemetry();
+
 							stateTitleScreen = true;
 							stateInGame = false;
 							stateGameRunning = false;
@@ -1247,17 +4065,27 @@ int main(int argc, char* args[])
 					}
 				}
 
+				// Capture frame
+				allocPhase = PHASE_PRESENT;
+				if (stateCapture) CaptureFrame();
+
 				// Update screen
+				TRACE_BEGIN(tracePresent);
 				SDL_RenderPresent(gRenderer);
+				TRACE_END(tracePresent, "Present");
+
+				// Finish allocation frame
+				allocPhase = PHASE_OTHER;
+				EndAllocFrame();
 
 				// Update time
 				lastTime = currentTime;
 			}
 		}
 
-		// Special case for grass
-		SDL_DestroyTexture(gGrassTexture);
-		gGrassTexture = NULL;
+		// Release textures held by main
+		ReleaseTexture(hGrass);
+		ReleaseTextures(RESOURCE_SPRITE);
 	}
 
 	// Deallocate memory and quit
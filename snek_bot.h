@@ -0,0 +1,75 @@
+/* Snek bot plugin interface
+ *
+ * A bot is a shared library exporting snek_bot_abi and snek_bot_decide, loaded with
+ * "snek -bot <path>". The game calls snek_bot_decide once per tick on its own thread
+ * and keeps the snake going straight when the call misses the deadline. A late call
+ * holds the game until it returns, its answer is then ignored.
+ */
+
+#ifndef SNEK_BOT_H
+#define SNEK_BOT_H
+
+#ifdef _WIN32
+#define SNEK_BOT_EXPORT __declspec(dllexport)
+#else
+#define SNEK_BOT_EXPORT __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Returned by snek_bot_abi, bots built against another version are rejected */
+#define SNEK_BOT_ABI 2
+
+/* Directions, same values as the game uses */
+enum SnekDirection
+{
+	SNEK_UP,
+	SNEK_DOWN,
+	SNEK_LEFT,
+	SNEK_RIGHT
+};
+
+/* Level tiles */
+enum SnekTile
+{
+	SNEK_EMPTY,
+	SNEK_WALL,
+	SNEK_PORTAL
+};
+
+/* Read-only view of the board, pointing straight into game memory
+ * Valid until snek_bot_decide returns, the game does not touch the board before that, even past the deadline */
+typedef struct SnekBoard
+{
+	int width, height;
+
+	/* width * height cells of 4 bytes, row by row: ticks until the body part leaves (0 is free),
+	 * sprite, direction the snake left the cell in, unused */
+	const unsigned char* cells;
+
+	/* width * height SnekTile bytes, row by row */
+	const unsigned char* level;
+
+	/* width * height cell indices (y * width + x) of the partner portal, -1 where there is no portal */
+	const short* portal;
+
+	int headX, headY;
+	int appleX, appleY;
+
+	/* Direction of the last move, turning back into it is ignored */
+	int direction;
+	int length;
+} SnekBoard;
+
+SNEK_BOT_EXPORT int snek_bot_abi(void);
+
+/* Direction of the next move */
+SNEK_BOT_EXPORT int snek_bot_decide(const SnekBoard* board);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif